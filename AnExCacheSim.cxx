@@ -297,7 +297,37 @@ AnExCacheSim::AnExCacheSim(const TString &name, AnalManager &mgr,
                            double min_vread) :
   AnalExtractor(name, mgr, out_file),
   f_min_vread(min_vread)
-{}
+{
+  UseBranch("F.mSizeMB");
+  UseBranch("F.mReadStats");
+  UseBranch("F.mSingleReadStats");
+  UseBranch("F.mVecReadStats");
+  UseBranch("F.mVecReadCntStats");
+  UseBranch("I.");
+
+  if (f_print_and_wait) SetPrintAndWait(true);
+}
+
+AnalExtractor* AnExCacheSim::Clone(AnalManager& mgr) const
+{
+  AnExCacheSim *x = new AnExCacheSim(mName, mgr, "", f_min_vread);
+  x->mOutFileName = mOutFileName;
+  x->SetPrintAndWait(f_print_and_wait);
+  return x;
+}
+
+void AnExCacheSim::SetPrintAndWait(bool p)
+{
+  f_print_and_wait = p;
+
+  if (p)
+  {
+    UseBranch("S.mHost");
+    UseBranch("U.mName");
+    UseBranch("U.mFromHost");
+    UseBranch("U.mRealName");
+  }
+}
 
 //==============================================================================
 
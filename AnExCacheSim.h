@@ -112,6 +112,14 @@ public:
   AnExCacheSim(const TString& name, AnalManager &mgr, const TString &out_file="",
                double min_vread=0);
 
+  AnalExtractor* Clone(AnalManager& mgr) const;
+
+  // Print each access and wait for enter, also declares the branches that
+  // are only printed. Call before processing starts.
+  void SetPrintAndWait(bool p);
+
+  const char* ClassTag() const { return "AnExCacheSim"; }
+
   // ----------------------------------------------------------------
 
   void BookHistos();
@@ -7,7 +7,11 @@
 #include <TFile.h>
 #include <TH1.h>
 #include <TH2.h>
+#include <TTree.h>
 #include <TGraph.h>
+#include <TVectorD.h>
+
+#include <algorithm>
 
 namespace
 {
@@ -22,7 +26,25 @@ namespace
 AnExIo::AnExIo(const TString& name, AnalManager& mgr,
                const TString& out_file) :
   AnalExtractor(name, mgr, out_file)
-{}
+{
+  UseBranch("F.mReadStats");
+  UseBranch("F.mSingleReadStats");
+  UseBranch("F.mVecReadStats");
+  UseBranch("F.mVecReadCntStats");
+  UseBranch("F.mSizeMB");
+}
+
+AnalExtractor* AnExIo::Clone(AnalManager& mgr) const
+{
+  // Copy dir and histo setup, histos themselves get booked later.
+
+  AnExIo *x = new AnExIo(mName, mgr);
+  x->mOutFileName = mOutFileName;
+  x->A_dirs       = A_dirs;
+  x->A_histos     = A_histos;
+  x->C_histos     = C_histos;
+  return x;
+}
 
 //==============================================================================
 
@@ -153,98 +175,252 @@ void AnExIo::WriteHistos()
   {
     DirHolder xxx(mFile);
 
-    std::vector<TH1D*>   hvec(N_C_histos);
-    std::vector<TGraph*> gvec(N_C_histos);
-    std::vector<TH1D*>   qvec(N_C_histos);
+    TString time_axis_title;
+    time_axis_title.Form("t in hours, %s - %s", M.mMinDate.Data(), M.mMaxDate.Data());
+
+    WriteCumHistos(C_histos, M.mTotalDtHour, time_axis_title);
+  }
 
-    std::vector<double> vTime(M.mTotalDtHour);
-    for (int i = 0; i < M.mTotalDtHour; ++i)
+  CloseFile();
+}
+
+//------------------------------------------------------------------------------
+
+void AnExIo::WriteCumHistos(std::vector<XHistoCum>& C_histos, int n_hours,
+                            const TString& time_axis_title)
+{
+  // Creates histos, graphs and _qhist histos from per-hour vectors in the
+  // current directory. Also used by AnalMerger on summed _qhist contents.
+
+  const int N_C_histos = C_histos.size();
+
+  std::vector<TH1D*>   hvec(N_C_histos);
+  std::vector<TGraph*> gvec(N_C_histos);
+  std::vector<TH1D*>   qvec(N_C_histos);
+
+  std::vector<double> vTime(n_hours);
+  for (int i = 0; i < n_hours; ++i)
+  {
+    vTime[i] = i;
+  }
+
+  // Calc min, max, create histos, create & fill graphs
+
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    XHistoCum           &xh = C_histos[j];
+    std::vector<double> &v  = xh.f_cum;
+
+    double min, max;
+    min = max = v[0];
+    for (int i = 1; i < n_hours; ++i)
     {
-      vTime[i] = i;
+      if (v[i] < min) min = v[i];
+      if (v[i] > max) max = v[i];
     }
 
-    // Calc min, max, create histos, create & fill graphs
+    // Conclusion here is: low is zero, log options are good. Which to take depends on whether
+    // we take log10 of the entry itself.
 
-    TString time_axis_title;
-    time_axis_title.Form("t in hours, %s - %s", M.mMinDate.Data(), M.mMaxDate.Data());
-
-    for (int j = 0; j < N_C_histos; ++j)
+    double l_logfix = 0, l_frcfix = 0, l_cf = 0, l_medfix = 0;
+    if (min > 0)
     {
-      XHistoCum           &xh = C_histos[j];
-      std::vector<double> &v  = xh.f_cum;
+      l_logfix = TMath::Power(10, TMath::Floor(TMath::Log10(min)));
+      l_frcfix = 1000 * TMath::Floor(0.1 * min);
+      l_cf     = TMath::Power(10, TMath::Floor(TMath::Log10(min)));
+      // Round on first most significant digit
+      l_medfix = l_cf * TMath::Floor(min / l_cf);
+    }
 
-      double min, max;
-      min = max = v[0];
-      for (int i = 1; i < M.mTotalDtHour; ++i)
-      {
-        if (v[i] < min) min = v[i];
-        if (v[i] > max) max = v[i];
-      }
+    printf("Minimum for '%s' = %f, lower bound estimates: %f, %f, %f\n"
+           "    this will not be applied, limit from setup %f will be kept.\n",
+           xh.f_name, min, l_logfix, l_medfix, l_frcfix,xh. f_xl);
 
-      // Conclusion here is: low is zero, log options are good. Which to take depends on whether
-      // we take log10 of the entry itself.
+    double h_logfix = TMath::Power(10, TMath::Ceil(TMath::Log10(max)));
+    double h_frcfix = 10 * TMath::Ceil(0.1 * max);
+    double h_cf     = TMath::Power(10, TMath::Floor(TMath::Log10(max)));
+    // Round on second most significant digit
+    double h_medfix = h_cf + h_cf/10 * TMath::Ceil((max - h_cf) / h_cf * 10);
 
-      double l_logfix = 0, l_frcfix = 0, l_cf = 0, l_medfix = 0;
-      if (min > 0)
-      {
-        l_logfix = TMath::Power(10, TMath::Floor(TMath::Log10(min)));
-        l_frcfix = 1000 * TMath::Floor(0.1 * min);
-        l_cf     = TMath::Power(10, TMath::Floor(TMath::Log10(min)));
-        // Round on first most significant digit
-        l_medfix = l_cf * TMath::Floor(min / l_cf);
-      }
+    printf("Maximum for '%s' = %f, upper bound estimates: %f, %f, %f\n",
+           xh.f_name, max, h_logfix, h_medfix, h_frcfix);
 
-      printf("Minimum for '%s' = %f, lower bound estimates: %f, %f, %f\n"
-             "    this will not be applied, limit from setup %f will be kept.\n",
-             xh.f_name, min, l_logfix, l_medfix, l_frcfix,xh. f_xl);
+    // xh.f_xl = min; // Don't touch, respect what is in config.
+    xh.f_xh = h_medfix;
 
-      double h_logfix = TMath::Power(10, TMath::Ceil(TMath::Log10(max)));
-      double h_frcfix = 10 * TMath::Ceil(0.1 * max);
-      double h_cf     = TMath::Power(10, TMath::Floor(TMath::Log10(max)));
-      // Round on second most significant digit
-      double h_medfix = h_cf + h_cf/10 * TMath::Ceil((max - h_cf) / h_cf * 10);
+    hvec[j] = new TH1D(xh.f_name, xh.f_title, xh.f_nbx, xh.f_xl, TMath::Log10(xh.f_xh));
 
-      printf("Maximum for '%s' = %f, upper bound estimates: %f, %f, %f\n",
-             xh.f_name, max, h_logfix, h_medfix, h_frcfix);
+    gvec[j] = new TGraph(n_hours, &vTime[0], &v[0]);
+    TString g_name (xh.f_name);  g_name += "_grf";
+    TString g_title(xh.f_title); g_title.ReplaceAll("log 10 of ", "");
+    gvec[j]->SetNameTitle(g_name, g_title);
+    gvec[j]->GetXaxis()->SetTitle(time_axis_title);
+    gDirectory->Add(gvec[j]);
 
-      // xh.f_xl = min; // Don't touch, respect what is in config.
-      xh.f_xh = h_medfix;
+    TString q_name (xh.f_name);  q_name += "_qhist";
+    TString q_title(xh.f_title); q_title.ReplaceAll("log 10 of ", "");
+    qvec[j] = new TH1D(q_name, q_title, n_hours, 0, n_hours);
+    qvec[j]->GetXaxis()->SetTitle(time_axis_title);
+    for (int q = 0; q < n_hours; ++q)
+    {
+      qvec[j]->SetBinContent(q+1, v[q]);
+      if ( ! xh.f_err.empty()) qvec[j]->SetBinError(q+1, xh.f_err[q]);
+    }
+  }
 
-      hvec[j] = new TH1D(xh.f_name, xh.f_title, xh.f_nbx, xh.f_xl, TMath::Log10(xh.f_xh));
+  // Fill histos
 
-      gvec[j] = new TGraph(M.mTotalDtHour, &vTime[0], &v[0]);
-      TString g_name (xh.f_name);  g_name += "_grf";
-      TString g_title(xh.f_title); g_title.ReplaceAll("log 10 of ", "");
-      gvec[j]->SetNameTitle(g_name, g_title);
-      gvec[j]->GetXaxis()->SetTitle(time_axis_title);
-      gDirectory->Add(gvec[j]);
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    XHistoCum           &xh = C_histos[j];
+    std::vector<double> &v  = xh.f_cum;
+    TH1D                *h  = hvec[j];
 
-      TString q_name (xh.f_name);  q_name += "_qhist";
-      TString q_title(xh.f_title); q_title.ReplaceAll("log 10 of ", "");
-      qvec[j] = new TH1D(q_name, q_title, M.mTotalDtHour, 0, M.mTotalDtHour);
-      qvec[j]->GetXaxis()->SetTitle(time_axis_title);
-      for (int q = 0; q < M.mTotalDtHour; ++q)
-      {
-        qvec[j]->SetBinContent(q+1, v[q]);
-      }
+    for (int i = 0; i < n_hours; ++i)
+    {
+      h->Fill(v[i] > 1 ? TMath::Log10(v[i]) : xh.f_xl);
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------
+
+void AnExIo::Merge(AnalExtractor* ex)
+{
+  AnalExtractor::Merge(ex);
+
+  AnExIo &o = * (AnExIo*) ex;
+
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    std::vector<double> &v  = C_histos[j].f_cum;
+    std::vector<double> &ov = o.C_histos[j].f_cum;
+
+    for (int i = 0; i < M.mTotalDtHour; ++i)
+    {
+      v[i] += ov[i];
     }
+  }
+
+  for (auto &kv : o.f_key_cum)
+  {
+    std::vector<double> &v = f_key_cum[kv.first];
+    v.resize(N_C_histos);
+    for (int j = 0; j < N_C_histos; ++j) v[j] += kv.second[j];
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void AnExIo::ScaleForSampling(Double_t fraction)
+{
+  // Per-hour sum over kept entries estimates the total as sum / f. Keys
+  // are kept independently, key k with sum T_k in an hour adds
+  // (1 - f) / f^2 T_k^2 to its variance, as in AnalManager::SampleVariance().
+
+  AnalExtractor::ScaleForSampling(fraction);
 
-    // Fill histos
+  const double f = fraction;
+
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    C_histos[j].f_err.assign(M.mTotalDtHour, 0);
+  }
 
+  for (auto &kv : f_key_cum)
+  {
+    const int hour = kv.first.second;
     for (int j = 0; j < N_C_histos; ++j)
     {
-      XHistoCum           &xh = C_histos[j];
-      std::vector<double> &v  = xh.f_cum;
-      TH1D                *h  = hvec[j];
+      C_histos[j].f_err[hour] += kv.second[j] * kv.second[j];
+    }
+  }
 
-      for (int i = 0; i < M.mTotalDtHour; ++i)
-      {
-        h->Fill(v[i] > 1 ? TMath::Log10(v[i]) : xh.f_xl);
-      }
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    for (auto &x : C_histos[j].f_cum) x /= f;
+    for (auto &e : C_histos[j].f_err) e  = TMath::Sqrt(e * (1 - f)) / f;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+
+void AnExIo::WriteState(TDirectory* dir)
+{
+  AnalExtractor::WriteState(dir);
+
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    std::vector<double> &v = C_histos[j].f_cum;
+
+    TVectorD vec(v.size(), &v[0]);
+    dir->WriteTObject(&vec, TString(C_histos[j].f_name) + "_cum");
+  }
+
+  if (N_C_histos > 0)
+  {
+    DirHolder xxx(dir);
+
+    ULong64_t key;
+    Int_t     hour;
+    std::vector<double> cum(N_C_histos);
+    TTree *t = new TTree("KeyCum", "");
+    t->Branch("key",  &key,       "key/l");
+    t->Branch("hour", &hour,      "hour/I");
+    t->Branch("cum",  cum.data(), TString::Format("cum[%d]/D", N_C_histos));
+    for (auto &kv : f_key_cum)
+    {
+      key = kv.first.first; hour = kv.first.second;
+      std::copy(kv.second.begin(), kv.second.end(), cum.begin());
+      t->Fill();
     }
+    t->Write();
   }
+}
 
-  CloseFile();
+void AnExIo::ReadState(TDirectory* dir)
+{
+  AnalExtractor::ReadState(dir);
+
+  for (int j = 0; j < N_C_histos; ++j)
+  {
+    std::vector<double> &v = C_histos[j].f_cum;
+
+    TVectorD *vec = (TVectorD*) dir->Get(TString(C_histos[j].f_name) + "_cum");
+    if ( ! vec || vec->GetNrows() != (Int_t) v.size())
+    {
+      fprintf(stderr, "AnExIo::ReadState bad or missing '%s_cum' in checkpoint. Dying ...\n",
+              C_histos[j].f_name);
+      exit(1);
+    }
+    std::copy(vec->GetMatrixArray(), vec->GetMatrixArray() + v.size(), v.begin());
+    delete vec;
+  }
+
+  if (N_C_histos > 0)
+  {
+    TTree *t = (TTree*) dir->Get("KeyCum");
+    if ( ! t)
+    {
+      fprintf(stderr, "AnExIo::ReadState missing 'KeyCum' in checkpoint. Dying ...\n");
+      exit(1);
+    }
+    ULong64_t key;
+    Int_t     hour;
+    std::vector<double> cum(N_C_histos);
+    t->SetBranchAddress("key",  &key);
+    t->SetBranchAddress("hour", &hour);
+    t->SetBranchAddress("cum",  cum.data());
+    f_key_cum.clear();
+    for (Long64_t i = 0; i < t->GetEntries(); ++i)
+    {
+      t->GetEntry(i);
+      f_key_cum[std::make_pair(key, hour)] = cum;
+    }
+    delete t;
+  }
 }
 
 
@@ -262,7 +438,7 @@ void AnExIo::Process()
 
   int dir_idx = -1;
   {
-    auto xx = f_dir_to_idx_map.find(M.mSlashRe[2]);
+    auto xx = f_dir_to_idx_map.find(M.PathPart(2));
     if (xx != f_dir_to_idx_map.end())
     {
       dir_idx = xx->second;
@@ -310,12 +486,22 @@ void AnExIo::Process()
 
   // Per hour statistics, cumulative
 
-  // Nasty hack ?
-  std::vector<double> &cvOpenEvents    = C_histos[0].f_cum;
-  std::vector<double> &cvCloseEvents   = C_histos[1].f_cum;
-  std::vector<double> &cvOpenFileHours = C_histos[2].f_cum;
-  std::vector<double> &cvReadRate      = C_histos[3].f_cum;
-  std::vector<double> &cvBytesRead     = C_histos[4].f_cum;
+  // Nasty hack ? Indices are the order of AddHistoCum() calls.
+  enum { OpenEvents, CloseEvents, OpenFileHours, ReadRate, BytesRead };
+
+  const bool      sampling = M.IsSampling();
+  const ULong64_t key      = sampling ? M.SampleKey() : 0;
+
+  auto cum = [&](int j, int hour, double x)
+  {
+    C_histos[j].f_cum[hour] += x;
+    if (sampling)
+    {
+      std::vector<double> &kc = f_key_cum[std::make_pair(key, hour)];
+      kc.resize(N_C_histos);
+      kc[j] += x;
+    }
+  };
 
   double open_hour  = (M.F.mOpenTime - M.mMinT) / Sec_to_Hour;
   double duration   = M.mDt / Sec_to_Hour;
@@ -324,8 +510,8 @@ void AnExIo::Process()
   //printf("M.F.mOpenTime = %lld, open_hour = %f     oe = %p\n", M.F.mOpenTime, open_hour, & cvOpenEvents[0]);
   //fflush(stdout);
 
-  ++cvOpenEvents [(int) open_hour ];
-  ++cvCloseEvents[(int) close_hour];
+  cum(OpenEvents,  (int) open_hour,  1);
+  cum(CloseEvents, (int) close_hour, 1);
 
   double yebo;
   double time_left     = duration;
@@ -335,9 +521,9 @@ void AnExIo::Process()
   {
     double hour_frac = TMath::Min(hour_frac_max, time_left);
 
-    cvOpenFileHours[hour] += hour_frac;
-    cvReadRate     [hour] += OneMB * M.F.mReadStats.mSumX * hour_frac / duration / 3600;
-    cvBytesRead    [hour] += OneMB * M.F.mReadStats.mSumX * hour_frac / duration;
+    cum(OpenFileHours, hour, hour_frac);
+    cum(ReadRate,      hour, OneMB * M.F.mReadStats.mSumX * hour_frac / duration / 3600);
+    cum(BytesRead,     hour, OneMB * M.F.mReadStats.mSumX * hour_frac / duration);
 
     time_left    -= hour_frac;
     hour_frac_max = 1;
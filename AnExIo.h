@@ -49,6 +49,7 @@ struct XHisto
 struct XHistoCum : public XHisto
 {
   std::vector<double> f_cum;
+  std::vector<double> f_err; // per-hour errors, empty unless sampled
 
   XHistoCum(const char *name, const char *title, int nbx,
             double xl, double xh, val_foo_t foo) :
@@ -76,10 +77,16 @@ protected:
   std::vector<XHistoCum>   C_histos;
   Int_t                    N_C_histos;
 
+  // Sums of each sampling key per hour, values in C_histos order. Kept
+  // only when sampling, they give the per-hour errors.
+  std::map<std::pair<ULong64_t, int>, std::vector<double>> f_key_cum;
+
 public:
 
   AnExIo(const TString& name, AnalManager &mgr, const TString& out_file="");
 
+  virtual AnalExtractor* Clone(AnalManager& mgr) const;
+
   void AddDir(const char *name, int accum_idx);
   void SetupAaaDirs();
 
@@ -96,6 +103,18 @@ public:
 
   virtual void WriteHistos();
 
+  static  void WriteCumHistos(std::vector<XHistoCum>& C_histos, int n_hours,
+                              const TString& time_axis_title);
+
+  virtual void Merge(AnalExtractor* ex);
+
+  virtual void ScaleForSampling(Double_t fraction);
+
+  virtual void WriteState(TDirectory* dir);
+  virtual void ReadState (TDirectory* dir);
+
+  virtual const char* ClassTag() const { return "AnExIo"; }
+
   // ----------------------------------------------------------------
 
   virtual void Process();
@@ -257,6 +257,9 @@ AnExIov::AnExIov(const TString &name, AnalManager &mgr,
                  const TString &out_file) :
   AnalExtractor(name, mgr, out_file)
 {
+  UseBranch("F.mSizeMB");
+  UseBranch("I.");
+
   allYs.push_back(&rall);
   allYs.push_back(&rsin);
   allYs.push_back(&rvec);
@@ -284,6 +287,13 @@ AnExIov::AnExIov(const TString &name, AnalManager &mgr,
   allYYs.push_back(&vir_vl);
 }
 
+AnalExtractor* AnExIov::Clone(AnalManager& mgr) const
+{
+  AnExIov *x = new AnExIov(mName, mgr);
+  x->mOutFileName = mOutFileName;
+  return x;
+}
+
 //==============================================================================
 
 // ranges:
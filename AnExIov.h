@@ -74,6 +74,10 @@ public:
 
   AnExIov(const TString& name, AnalManager &mgr, const TString& out_file="");
 
+  AnalExtractor* Clone(AnalManager& mgr) const;
+
+  const char* ClassTag() const { return "AnExIov"; }
+
   // ----------------------------------------------------------------
 
   void BookHistos();
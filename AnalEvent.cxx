@@ -0,0 +1,77 @@
+#include "AnalEvent.h"
+
+#include <TMath.h>
+
+#include <utility>
+
+//==============================================================================
+
+void swap_content(SXrdFileInfo& a, SXrdFileInfo& b)
+{
+  using std::swap;
+  swap(a.mName,            b.mName);
+  swap(a.mOpenTime,        b.mOpenTime);
+  swap(a.mCloseTime,       b.mCloseTime);
+  swap(a.mReadStats,       b.mReadStats);
+  swap(a.mSingleReadStats, b.mSingleReadStats);
+  swap(a.mVecReadStats,    b.mVecReadStats);
+  swap(a.mVecReadCntStats, b.mVecReadCntStats);
+  swap(a.mWriteStats,      b.mWriteStats);
+  swap(a.mRTotalMB,        b.mRTotalMB);
+  swap(a.mWTotalMB,        b.mWTotalMB);
+  swap(a.mSizeMB,          b.mSizeMB);
+}
+
+void swap_content(SXrdUserInfo& a, SXrdUserInfo& b)
+{
+  using std::swap;
+  swap(a.mName,           b.mName);
+  swap(a.mRealName,       b.mRealName);
+  swap(a.mDN,             b.mDN);
+  swap(a.mVO,             b.mVO);
+  swap(a.mRole,           b.mRole);
+  swap(a.mGroup,          b.mGroup);
+  swap(a.mServerUsername, b.mServerUsername);
+  swap(a.mFromHost,       b.mFromHost);
+  swap(a.mFromDomain,     b.mFromDomain);
+  swap(a.mAppInfo,        b.mAppInfo);
+  swap(a.mLoginTime,      b.mLoginTime);
+  swap(a.bNumericHost,    b.bNumericHost);
+}
+
+void swap_content(SXrdServerInfo& a, SXrdServerInfo& b)
+{
+  using std::swap;
+  swap(a.mHost,   b.mHost);
+  swap(a.mDomain, b.mDomain);
+  swap(a.mSite,   b.mSite);
+}
+
+void swap_content(SXrdIoInfo& a, SXrdIoInfo& b)
+{
+  using std::swap;
+  swap(a.mReqs,      b.mReqs);
+  swap(a.mNErrors,   b.mNErrors);
+  swap(a.mOffsetVec, b.mOffsetVec);
+  swap(a.mLengthVec, b.mLengthVec);
+}
+
+//==============================================================================
+
+AnalEventDeriver::AnalEventDeriver() :
+  m_domain_re("[^.]+\\.[^.]+$", "o"),
+  m_slash_re("/", "o")
+{}
+
+void AnalEventDeriver::Derive(const SXrdFileInfo& F, const SXrdUserInfo& U, const SXrdServerInfo& S,
+                              Double_t& dt, TString& s_domain, TString& u_domain, vTString_t& path)
+{
+  dt = TMath::Max(1ll, F.mCloseTime - F.mOpenTime);
+
+  s_domain = (m_domain_re.Match(S.mDomain))     ? m_domain_re[0] : "";
+  u_domain = (m_domain_re.Match(U.mFromDomain)) ? m_domain_re[0] : "";
+
+  Int_t n = m_slash_re.Split(F.mName);
+  path.resize(n);
+  for (Int_t i = 0; i < n; ++i) path[i] = m_slash_re[i];
+}
@@ -0,0 +1,71 @@
+#ifndef AnalEvent_h
+#define AnalEvent_h
+
+#include "SXrdClasses.h"
+
+#include <TPRegexp.h>
+
+#include <vector>
+
+typedef std::vector<TString> vTString_t;
+
+//==============================================================================
+// AnalEvent
+//==============================================================================
+
+// One entry with the values AnalManager derives from it, as passed between
+// stages of the pipelined event loop, see AnalManager::SetPipeline().
+// Events are recycled, contents are moved by swapping so that string and
+// vector buffers are reused.
+
+struct AnalEvent
+{
+  SXrdFileInfo    F;
+  SXrdUserInfo    U;
+  SXrdServerInfo  S;
+  SXrdIoInfo      I;
+
+  Long64_t        f_chain_i;
+  Long64_t        f_tree_i;
+  Int_t           f_tree_number;
+
+  Double_t        f_dt;
+  TString         f_s_domain, f_u_domain;
+  vTString_t      f_path;
+
+  AnalEvent() : f_chain_i(-1), f_tree_i(-1), f_tree_number(-1), f_dt(0) {}
+};
+
+// Member-wise swaps, the SXrd classes are generated and have no move
+// operations. Have to be kept in sync with SXrdClasses.h.
+
+void swap_content(SXrdFileInfo&   a, SXrdFileInfo&   b);
+void swap_content(SXrdUserInfo&   a, SXrdUserInfo&   b);
+void swap_content(SXrdServerInfo& a, SXrdServerInfo& b);
+void swap_content(SXrdIoInfo&     a, SXrdIoInfo&     b);
+
+//==============================================================================
+// AnalEventDeriver
+//==============================================================================
+
+// Computes duration, server / user domains and path components of an
+// entry. Regexps keep match state, each thread needs its own deriver.
+
+class AnalEventDeriver
+{
+  TPMERegexp m_domain_re;
+  TPMERegexp m_slash_re;
+
+public:
+  AnalEventDeriver();
+
+  void Derive(const SXrdFileInfo& F, const SXrdUserInfo& U, const SXrdServerInfo& S,
+              Double_t& dt, TString& s_domain, TString& u_domain, vTString_t& path);
+
+  void Derive(AnalEvent& ev)
+  {
+    Derive(ev.F, ev.U, ev.S, ev.f_dt, ev.f_s_domain, ev.f_u_domain, ev.f_path);
+  }
+};
+
+#endif
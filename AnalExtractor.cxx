@@ -2,6 +2,117 @@
 #include "AnalManager.h"
 
 #include <TFile.h>
+#include <TMemFile.h>
+#include <TH1.h>
+#include <TTree.h>
+#include <TChain.h>
+#include <TMath.h>
+#include <TList.h>
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+  void merge_histos(TDirectory *dir, TDirectory *src)
+  {
+    // Objects from src are owned by it, also when read from a file.
+    // TH1::Merge() because time axes of replicas need not agree yet, they
+    // get aligned by FinalizeAnExIo() only after merging.
+
+    TIter next(dir->GetList());
+    while (TObject *obj = next())
+    {
+      if (obj->InheritsFrom(TDirectory::Class()))
+      {
+        TDirectory *sdir = src->GetDirectory(obj->GetName());
+        if ( ! sdir)
+        {
+          fprintf(stderr, "AnalExtractor::Merge directory '%s' not found in '%s'.\n",
+                  obj->GetName(), src->GetPath());
+          continue;
+        }
+        merge_histos((TDirectory*) obj, sdir);
+      }
+      else if (obj->InheritsFrom(TH1::Class()))
+      {
+        TH1 *sh = (TH1*) src->Get(obj->GetName());
+        if ( ! sh)
+        {
+          fprintf(stderr, "AnalExtractor::Merge '%s' not found in '%s'.\n",
+                  obj->GetName(), src->GetPath());
+          continue;
+        }
+        TList l;
+        l.Add(sh);
+        ((TH1*) obj)->Merge(&l);
+      }
+    }
+  }
+
+  void scale_histos(TDirectory *dir, Double_t f)
+  {
+    TIter next(dir->GetList());
+    while (TObject *obj = next())
+    {
+      if (obj->InheritsFrom(TDirectory::Class()))
+      {
+        scale_histos((TDirectory*) obj, f);
+      }
+      else if (obj->InheritsFrom(TH1::Class()))
+      {
+        // Binomial, entry i kept with probability f adds (1 - f) / f^2 w_i^2.
+        // Whole files are kept or dropped, so this is a lower bound.
+        TH1 *h = (TH1*) obj;
+        if (h->GetSumw2N() == 0) h->Sumw2();
+        h->Scale(1 / f);
+        const Double_t ef = TMath::Sqrt(1 - f);
+        for (Int_t i = 0; i < h->GetNcells(); ++i)
+        {
+          h->SetBinError(i, ef * h->GetBinError(i));
+        }
+      }
+    }
+  }
+
+  Long64_t histo_bytes(TDirectory *dir)
+  {
+    // Bin contents plus sum of weights squared, object overhead ignored.
+    Long64_t n = 0;
+    TIter next(dir->GetList());
+    while (TObject *obj = next())
+    {
+      if (obj->InheritsFrom(TDirectory::Class()))
+      {
+        n += histo_bytes((TDirectory*) obj);
+      }
+      else if (obj->InheritsFrom(TH1::Class()))
+      {
+        TH1 *h = (TH1*) obj;
+        Int_t w = dynamic_cast<TArrayF*>(h) || dynamic_cast<TArrayI*>(h) ? 4 :
+                  dynamic_cast<TArrayS*>(h) ? 2 : dynamic_cast<TArrayC*>(h) ? 1 : 8;
+        n += (Long64_t) h->GetNcells() * w + (Long64_t) h->GetSumw2N() * 8;
+      }
+    }
+    return n;
+  }
+
+  void write_histos(TDirectory *dir, TDirectory *dst)
+  {
+    TIter next(dir->GetList());
+    while (TObject *obj = next())
+    {
+      if (obj->InheritsFrom(TDirectory::Class()))
+      {
+        write_histos((TDirectory*) obj, dst->mkdir(obj->GetName()));
+      }
+      else if (obj->InheritsFrom(TH1::Class()))
+      {
+        dst->WriteTObject(obj);
+      }
+    }
+  }
+}
 
 //==============================================================================
 
@@ -39,7 +150,11 @@ void AnalExtractor::DirHolder::cd_ex()
 AnalExtractor::AnalExtractor(const TString& name, AnalManager& mgr,
                              const TString& out_file) :
   AnalFilter(name, mgr),
-  mFile(0)
+  mFile(0),
+  mNextReorder(0),
+  mRequired(0), mForbidden(0),
+  mSkimFile(0), mSkimTree(0),
+  mHistoBytes(0)
 {
   mOutFileName  = M.RefOutDirName() + "/";
   mOutFileName += out_file.IsNull() ? name : out_file;
@@ -53,30 +168,196 @@ AnalExtractor::AnalExtractor(const TString& name, AnalManager& mgr,
 
 void AnalExtractor::OpenFile()
 {
-  mFile = TFile::Open(mOutFileName, "create");
-  if ( ! mFile)
+  if (M.IsWorker())
   {
-    fprintf(stderr, "Opening of output file '%s' failed. Probably it exists already.\n",
-            mOutFileName.Data());
-    exit(2);
+    // Replicas only accumulate, results get merged into the master.
+    mFile = new TMemFile(TString::Format("%s.w%d", mOutFileName.Data(), M.GetWorkerId()),
+                         "recreate");
   }
+  else
+  {
+    // Outputs of an interrupted run are only written at the end, if at all.
+    mFile = TFile::Open(mOutFileName, M.IsResuming() ? "recreate" : "create");
+    if ( ! mFile)
+    {
+      fprintf(stderr, "Opening of output file '%s' failed. Probably it exists already.\n",
+              mOutFileName.Data());
+      exit(2);
+    }
+  }
+
+  mFile->Add(new TNamed("AnalExtractorClass", ClassTag()));
 }
 
 void AnalExtractor::CloseFile()
 {
-  mFile->Write();
+  mHistoBytes = histo_bytes(mFile);
+  if ( ! M.IsWorker())
+    mFile->Write();
   mFile->Close();
   delete mFile;
   mFile = 0;
 }
 
+//------------------------------------------------------------------------------
+
+void AnalExtractor::SetSkim(const vTString_t& branches)
+{
+  for (auto &b : branches)
+  {
+    if (b != "F." && b != "U." && b != "S." && b != "I.")
+    {
+      fprintf(stderr, "AnalExtractor::SetSkim unknown branch '%s', use F., U., S. or I. Dying ...\n",
+              b.Data());
+      exit(1);
+    }
+    // Whole top-level branch has to be read to be written out.
+    UseBranch(b);
+  }
+  mSkimBranches = branches;
+}
+
+void AnalExtractor::OpenSkim()
+{
+  TString fname = mOutFileName;
+  fname.Remove(fname.Length() - 5); // .root
+  if (M.IsWorker())
+    fname += TString::Format("-skim-w%d.root", M.GetWorkerId());
+  else
+    fname += "-skim.root";
+
+  DirHolder _dh;
+
+  mSkimFile = TFile::Open(fname, "create");
+  if ( ! mSkimFile)
+  {
+    fprintf(stderr, "Opening of skim file '%s' failed. Probably it exists already.\n",
+            fname.Data());
+    exit(2);
+  }
+
+  mSkimTree = new TTree(M.GetChain()->GetName(), mName + " skim");
+  for (auto &b : mSkimBranches)
+  {
+    if      (b == "F.") mSkimTree->Branch("F.", &M._fp);
+    else if (b == "U.") mSkimTree->Branch("U.", &M._up);
+    else if (b == "S.") mSkimTree->Branch("S.", &M._sp);
+    else if (b == "I.") mSkimTree->Branch("I.", &M._ip);
+  }
+}
+
+void AnalExtractor::FillSkim()
+{
+  mSkimTree->Fill();
+}
+
+void AnalExtractor::CloseSkim()
+{
+  DirHolder _dh(mSkimFile);
+
+  mSkimTree->Write();
+
+  if ( ! M.IsWorker())
+    printf("Extractor %s skimmed %lld entries into '%s'.\n", mName.Data(),
+           mSkimTree->GetEntries(), mSkimFile->GetName());
+
+  mSkimFile->Close();
+  delete mSkimFile;
+  mSkimFile = 0;
+  mSkimTree = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void AnalExtractor::Merge(AnalExtractor* ex)
+{
+  merge_histos(mFile, ex->mFile);
+}
+
+void AnalExtractor::ScaleForSampling(Double_t fraction)
+{
+  scale_histos(mFile, fraction);
+}
+
+Long64_t AnalExtractor::GetHistoBytes() const
+{
+  return mFile ? histo_bytes(mFile) : mHistoBytes;
+}
+
+void AnalExtractor::WriteState(TDirectory* dir)
+{
+  write_histos(mFile, dir);
+}
+
+void AnalExtractor::ReadState(TDirectory* dir)
+{
+  // Histos are freshly booked, adding is the same as setting.
+  merge_histos(mFile, dir);
+}
+
 //==============================================================================
 
 bool AnalExtractor::Filter()
 {
-  if ( ! AllFiltersPass(mFilters)) return false;
+  const ULong64_t eval = M.GetFilterEvalMask();
+  const ULong64_t pass = M.GetFilterPassMask();
+  const ULong64_t all  = mRequired | mForbidden;
 
-  if ( ! AllFiltersFail(mAntiFilters)) return false;
+  if ((mRequired & eval & ~pass) || (mForbidden & pass))  return false;
+
+  if ((all & eval) == all)  return true;
+
+  if (mTotalCount >= mNextReorder)
+  {
+    ReorderTerms();
+  }
+
+  for (auto const &t : mTerms)
+  {
+    if (t.f_filter->Eval() == t.f_anti)  return false;
+  }
 
   return true;
 }
+
+void AnalExtractor::SetupMasks()
+{
+  mRequired = mForbidden = 0;
+  for (auto f : mFilters)     mRequired  |= f->BitMask();
+  for (auto f : mAntiFilters) mForbidden |= f->BitMask();
+}
+
+void AnalExtractor::ReorderTerms()
+{
+  // Most rejecting terms first, the chain then stops earliest. Only counts
+  // are used, not measured times, so the order is the same in every run
+  // over the same entries. Filters without statistics go first so they
+  // get some.
+
+  auto rank = [](const FilterTerm& t)
+  {
+    const AnalFilter &f = *t.f_filter;
+    if (f.GetTotalCount() == 0) return -1.0;
+
+    Double_t p_pass = f.GetPassCount() / (Double_t) f.GetTotalCount();
+    Double_t p_rej  = t.f_anti ? p_pass : 1 - p_pass;
+
+    return 1 - p_rej;
+  };
+
+  std::vector<Double_t> ranks;
+  for (auto const &t : mTerms) ranks.push_back(rank(t));
+
+  std::vector<size_t> idx(mTerms.size());
+  for (size_t i = 0; i < idx.size(); ++i) idx[i] = i;
+  std::stable_sort(idx.begin(), idx.end(),
+                   [&](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+
+  std::vector<FilterTerm> terms;
+  for (auto i : idx) terms.push_back(mTerms[i]);
+  mTerms.swap(terms);
+
+  // Reorder often at first, then keep the order.
+  mNextReorder = mTotalCount < ReorderCalibEntries ? mTotalCount + TMath::Max(mTotalCount, 1000ll)
+                                                   : LLONG_MAX;
+}
@@ -7,6 +7,7 @@ class AnalManager;
 
 class TFile;
 class TDirectory;
+class TTree;
 
 //------------------------------------------------------------------------------
 
@@ -34,24 +35,95 @@ protected:
   vpAnalFilter_t    mFilters;     // Must all pass
   vpAnalFilter_t    mAntiFilters; // Must all fail
 
+  struct FilterTerm
+  {
+    AnalFilter *f_filter;
+    bool        f_anti;
+  };
+
+  std::vector<FilterTerm> mTerms; // Both of the above, in evaluation order.
+  Long64_t          mNextReorder; // mTotalCount at which to reorder mTerms.
+
+  // Order of mTerms is frozen after this many entries.
+  static const Long64_t ReorderCalibEntries = 100000;
+
+  ULong64_t         mRequired;    // Bits of mFilters
+  ULong64_t         mForbidden;   // Bits of mAntiFilters
+
+  void ReorderTerms();
+  void SetupMasks();
+
+  vTString_t        mSkimBranches; // Top-level branches written to skim.
+  TFile            *mSkimFile;
+  TTree            *mSkimTree;
+
+  AnalStageTime     mProcessTime; // Spent in Process(), by AnalManager.
+  Long64_t          mHistoBytes;  // Of mFile, kept from CloseFile().
+
 public:
 
   AnalExtractor(const TString& name, AnalManager &mgr, const TString& out_file="");
 
-  void AddFilter(AnalFilter* f)     { mFilters    .push_back(f); }
-  void AddAntiFilter(AnalFilter* f) { mAntiFilters.push_back(f); }
+  void AddFilter(AnalFilter* f)     { mFilters    .push_back(f); mTerms.push_back({ f, false }); }
+  void AddAntiFilter(AnalFilter* f) { mAntiFilters.push_back(f); mTerms.push_back({ f, true  }); }
+
+  const AnalStageTime& RefProcessTime() const { return mProcessTime; }
 
   void OpenFile();
   void CloseFile();
 
+  // Write passing entries into an XrdFar-compatible tree in
+  // <out_dir>/<name>-skim.root, or <name>-skim-w<id>.root for each worker
+  // when running with threads. Branches are top-level ones, F., U., S.
+  // and / or I.; without I. read the skim with setup_I_branch = false.
+  void SetSkim(const vTString_t& branches = { "F.", "U.", "S.", "I." });
+
+  bool IsSkimming() const { return ! mSkimBranches.empty(); }
+
+  void OpenSkim();
+  void FillSkim();
+  void CloseSkim();
+
+  // Replica with the same configuration but no filters, see
+  // AnalManager::ProcessParallel().
+  virtual AnalExtractor* Clone(AnalManager& mgr) const = 0;
+
+  // Written into the output file as AnalExtractorClass, tells AnalMerger
+  // how to combine outputs of shards.
+  virtual const char* ClassTag() const { return "AnalExtractor"; }
+
   // ----------------------------------------------------------------
 
   virtual void BookHistos()  {}
 
   virtual void WriteHistos() {}
 
+  // Add results accumulated by a replica. Default adds up all histograms
+  // found under the same path in mFile.
+  virtual void Merge(AnalExtractor* ex);
+
+  // Turn results of a run keeping a fraction of entries into estimates
+  // for all of them, see AnalManager::SetSampling(). Default scales all
+  // histograms in mFile by 1 / fraction and sets binomial errors.
+  virtual void ScaleForSampling(Double_t fraction);
+
+  // Memory of histograms in mFile, or in it when it was closed, for the
+  // run report of AnalManager.
+  Long64_t GetHistoBytes() const;
+
+  // Save / restore accumulated results for checkpointing, see
+  // AnalManager::SetCheckpoint(). Default handles all histograms in mFile;
+  // extractors with other accumulators have to extend these.
+  virtual void WriteState(TDirectory* dir);
+  virtual void ReadState (TDirectory* dir);
+
   // ----------------------------------------------------------------
 
+  // Decides on already known filter results with two mask operations, the
+  // rest are evaluated on demand, stopping at the first one that rejects
+  // the entry. Order is most rejecting first, from counts over the first
+  // ReorderCalibEntries entries, then it stays fixed. Counts of filters
+  // that do not depend on the order need SetExactFilterCounts().
   virtual bool Filter();
 
   virtual void Process() = 0;
@@ -0,0 +1,107 @@
+#include "AnalFanOut.h"
+
+//==============================================================================
+
+AnalFanOut::AnalFanOut(Int_t n_threads, const Task_t& task) :
+  mTask(task),
+  mClaim(0), mDone(0), mStop(false),
+  mSerial(0),
+  mNParked(0)
+{
+  for (Int_t i = 0; i < n_threads; ++i)
+  {
+    mThreads.emplace_back([this]()
+    {
+      Int_t idle = 0;
+      while ( ! mStop)
+      {
+        if (RunOne())
+        {
+          idle = 0;
+        }
+        else if (++idle < SpinCount)
+        {
+          std::this_thread::yield();
+        }
+        else
+        {
+          // Parked count goes up before the claim is checked, Run() stores
+          // the claim before it reads the count, so one of them sees the
+          // other.
+          std::unique_lock<std::mutex> lock(mParkMutex);
+          ++mNParked;
+          mParkCond.wait(lock, [this]() { return mStop || HasWork(); });
+          --mNParked;
+          idle = 0;
+        }
+      }
+    });
+  }
+}
+
+AnalFanOut::~AnalFanOut()
+{
+  {
+    std::lock_guard<std::mutex> lock(mParkMutex);
+    mStop = true;
+  }
+  mParkCond.notify_all();
+  for (auto &t : mThreads) t.join();
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalFanOut::HasWork() const
+{
+  ULong64_t c = mClaim.load();
+  return (c & 0xffff) < ((c >> 16) & 0xffff);
+}
+
+bool AnalFanOut::RunOne()
+{
+  // Claim next task of the current batch, false if there is none.
+
+  ULong64_t c = mClaim.load(std::memory_order_acquire);
+  for (;;)
+  {
+    UInt_t next = c & 0xffff;
+    UInt_t n    = (c >> 16) & 0xffff;
+    if (next >= n) return false;
+
+    if (mClaim.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel))
+    {
+      mTask(next);
+      mDone.fetch_add(1, std::memory_order_release);
+      return true;
+    }
+  }
+}
+
+void AnalFanOut::Run(Int_t n_tasks)
+{
+  if (n_tasks == 0) return;
+
+  if (n_tasks == 1 || mThreads.empty())
+  {
+    for (Int_t i = 0; i < n_tasks; ++i) mTask(i);
+    return;
+  }
+
+  // All tasks of the previous batch are done, nobody can be using mDone.
+  mDone.store(0, std::memory_order_relaxed);
+  ++mSerial;
+  mClaim.store(((mSerial & 0xffffffff) << 32) | (ULong64_t(n_tasks) << 16));
+
+  if (mNParked.load() > 0)
+  {
+    std::lock_guard<std::mutex> lock(mParkMutex);
+    mParkCond.notify_all();
+  }
+
+  while (RunOne()) {}
+
+  while (mDone.load(std::memory_order_acquire) < n_tasks)
+  {
+    std::this_thread::yield();
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef AnalFanOut_h
+#define AnalFanOut_h
+
+#include <Rtypes.h>
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//==============================================================================
+// AnalFanOut
+//==============================================================================
+
+// Runs tasks 0 ... n-1 of a batch concurrently on a set of threads and the
+// calling one, Run() returns when all are done. Meant for many short
+// batches (one per entry), so idle threads spin with yield for a while
+// and only then park on a condition variable, Run() wakes them when
+// any are parked.
+//
+// Tasks are claimed through a single atomic word holding batch serial
+// number, task count and next index, so a claim prepared for one batch
+// can not succeed on a later one.
+
+class AnalFanOut
+{
+public:
+  typedef std::function<void (Int_t)> Task_t;
+
+private:
+  Task_t                   mTask;
+  std::vector<std::thread> mThreads;
+  std::atomic<ULong64_t>   mClaim;    // serial << 32 | n << 16 | next
+  std::atomic<Int_t>       mDone;
+  std::atomic<bool>        mStop;
+  ULong64_t                mSerial;
+
+  std::mutex               mParkMutex;
+  std::condition_variable  mParkCond;
+  std::atomic<Int_t>       mNParked;
+
+  // Yields without finding work before a thread parks.
+  static const Int_t SpinCount = 1000;
+
+  bool HasWork() const;
+  bool RunOne();
+
+public:
+  AnalFanOut(Int_t n_threads, const Task_t& task);
+  ~AnalFanOut();
+
+  // At most 65535 tasks per batch.
+  void Run(Int_t n_tasks);
+
+  Int_t GetNThreads() const { return mThreads.size(); }
+};
+
+#endif
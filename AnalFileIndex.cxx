@@ -0,0 +1,293 @@
+#include "AnalFileIndex.h"
+
+#include "SXrdClasses.h"
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TSystem.h>
+#include <TRegexp.h>
+#include <TMD5.h>
+
+#include <algorithm>
+#include <climits>
+
+//==============================================================================
+
+AnalFileIndex::AnalFileIndex() :
+  mSize(-1), mMTime(-1),
+  mEntries(0),
+  mMinOpen (LLONG_MAX), mMaxOpen (LLONG_MIN),
+  mMinClose(LLONG_MAX), mMaxClose(LLONG_MIN)
+{}
+
+//==============================================================================
+
+bool AnalFileIndex::Build(const TString& file, const TString& tree_name)
+{
+  // Read only open / close times and server domain.
+
+  *this = AnalFileIndex();
+
+  mFile = file;
+  if ( ! FileStamp(file, mSize, mMTime, mChecksum)) return false;
+
+  TFile *f = TFile::Open(file);
+  TTree *t = f ? (TTree*) f->Get(tree_name) : 0;
+  if ( ! t)
+  {
+    fprintf(stderr, "AnalFileIndex::Build can not read tree '%s' from '%s'.\n",
+            tree_name.Data(), file.Data());
+    delete f;
+    return false;
+  }
+
+  SXrdFileInfo   F, *fp = &F;
+  SXrdServerInfo S, *sp = &S;
+
+  t->SetBranchStatus("*", 0);
+  t->SetBranchStatus("F.mOpenTime",  1);
+  t->SetBranchStatus("F.mCloseTime", 1);
+  t->SetBranchStatus("S.mDomain",    1);
+  t->SetBranchAddress("F.", &fp);
+  t->SetBranchAddress("S.", &sp);
+
+  mEntries = t->GetEntries();
+
+  const Int_t n_blocks = (mEntries + BlockSize - 1) / BlockSize;
+  mBlockMin.assign(n_blocks, LLONG_MAX);
+  mBlockMax.assign(n_blocks, LLONG_MIN);
+
+  for (Long64_t i = 0; i < mEntries; ++i)
+  {
+    t->GetEntry(i);
+
+    mMinOpen  = std::min(mMinOpen,  F.mOpenTime);
+    mMaxOpen  = std::max(mMaxOpen,  F.mOpenTime);
+    mMinClose = std::min(mMinClose, F.mCloseTime);
+    mMaxClose = std::max(mMaxClose, F.mCloseTime);
+
+    const Int_t b = i / BlockSize;
+    mBlockMin[b] = std::min(mBlockMin[b], std::min(F.mOpenTime, F.mCloseTime));
+    mBlockMax[b] = std::max(mBlockMax[b], std::max(F.mOpenTime, F.mCloseTime));
+
+    mServerDomains.insert(S.mDomain);
+  }
+
+  delete f;
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalFileIndex::Read(const TString& idx_file)
+{
+  FILE *fp = fopen(idx_file, "r");
+  if ( ! fp) return false;
+
+  *this = AnalFileIndex();
+
+  char   key[64];
+  char   val[4096];
+  bool   ok = true;
+  Int_t  n_blocks = -1;
+
+  while (ok && fscanf(fp, "%63s", key) == 1)
+  {
+    TString k(key);
+
+    if (k == "#")
+    {
+      ok = fscanf(fp, "%*[^\n]") == 0;
+      continue;
+    }
+    if (k == "server_domains")
+    {
+      Int_t n;
+      ok = fscanf(fp, "%d", &n) == 1;
+      for (Int_t i = 0; ok && i < n; ++i)
+      {
+        ok = fscanf(fp, "%4095s", val) == 1;
+        mServerDomains.insert(strcmp(val, "-") ? val : "");
+      }
+      continue;
+    }
+    if (k == "blocks")
+    {
+      ok = fscanf(fp, "%d", &n_blocks) == 1;
+      for (Int_t b = 0; ok && b < n_blocks; ++b)
+      {
+        Long64_t min, max;
+        ok = fscanf(fp, "%lld %lld", &min, &max) == 2;
+        mBlockMin.push_back(min);
+        mBlockMax.push_back(max);
+      }
+      continue;
+    }
+
+    ok = fscanf(fp, " %4095[^\n]", val) == 1;
+    TString v(val);
+
+    if      (k == "file")      mFile     = v;
+    else if (k == "size")      mSize     = v.Atoll();
+    else if (k == "mtime")     mMTime    = v.Atoll();
+    else if (k == "checksum")  mChecksum = v;
+    else if (k == "entries")   mEntries  = v.Atoll();
+    else if (k == "open_min")  mMinOpen  = v.Atoll();
+    else if (k == "open_max")  mMaxOpen  = v.Atoll();
+    else if (k == "close_min") mMinClose = v.Atoll();
+    else if (k == "close_max") mMaxClose = v.Atoll();
+  }
+
+  fclose(fp);
+
+  return ok && n_blocks == (Int_t) mBlockMin.size() &&
+         n_blocks == (mEntries + BlockSize - 1) / BlockSize;
+}
+
+bool AnalFileIndex::Write(const TString& idx_file) const
+{
+  // Write to a temporary and rename so that readers never see a partial file.
+  // Pid in the name as shards of one job can rebuild the same index.
+
+  TString tmp_file = TString::Format("%s.tmp%d", idx_file.Data(), gSystem->GetPid());
+
+  FILE *fp = fopen(tmp_file, "w");
+  if ( ! fp)
+  {
+    fprintf(stderr, "AnalFileIndex::Write can not write '%s'.\n", tmp_file.Data());
+    return false;
+  }
+
+  fprintf(fp, "# AnalFileIndex 1\n");
+  fprintf(fp, "file %s\n",      mFile.Data());
+  fprintf(fp, "size %lld\n",    mSize);
+  fprintf(fp, "mtime %lld\n",   mMTime);
+  fprintf(fp, "checksum %s\n",  mChecksum.Data());
+  fprintf(fp, "entries %lld\n", mEntries);
+  fprintf(fp, "open_min %lld\n",  mMinOpen);
+  fprintf(fp, "open_max %lld\n",  mMaxOpen);
+  fprintf(fp, "close_min %lld\n", mMinClose);
+  fprintf(fp, "close_max %lld\n", mMaxClose);
+  fprintf(fp, "server_domains %d", (Int_t) mServerDomains.size());
+  for (auto &d : mServerDomains) fprintf(fp, " %s", d.IsNull() ? "-" : d.Data());
+  fprintf(fp, "\n");
+  fprintf(fp, "blocks %d\n", (Int_t) mBlockMin.size());
+  for (size_t b = 0; b < mBlockMin.size(); ++b)
+  {
+    fprintf(fp, "%lld %lld\n", mBlockMin[b], mBlockMax[b]);
+  }
+
+  bool ok = (fclose(fp) == 0);
+
+  return ok && gSystem->Rename(tmp_file, idx_file) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalFileIndex::IsCurrent(const TString& file) const
+{
+  Long64_t size, mtime;
+  TString  checksum;
+
+  if ( ! FileStamp(file, size, mtime, checksum)) return false;
+
+  return size == mSize && mtime == mMTime && checksum == mChecksum;
+}
+
+//==============================================================================
+
+TString AnalFileIndex::SidecarName(const TString& file, const TString& idx_dir)
+{
+  // In idx_dir, anidx/ of the working directory by default, so read-only
+  // or shared data directories are left alone. The whole path of the data
+  // file goes into the name, files of the same name in different
+  // directories get separate indices.
+
+  TString dir  = idx_dir.IsNull() ? TString(gSystem->WorkingDirectory()) + "/anidx" : idx_dir;
+  TString path = file;
+  if ( ! gSystem->IsAbsoluteFileName(path)) path = TString(gSystem->WorkingDirectory()) + "/" + path;
+  path.ReplaceAll("/", "%");
+
+  return dir + "/" + path + ".anidx";
+}
+
+bool AnalFileIndex::FileStamp(const TString& file, Long64_t& size, Long64_t& mtime,
+                              TString& checksum)
+{
+  static const Long64_t Chunk = 1024 * 1024;
+
+  FileStat_t st;
+  if (gSystem->GetPathInfo(file, st) != 0)
+  {
+    fprintf(stderr, "AnalFileIndex::FileStamp can not stat '%s'.\n", file.Data());
+    return false;
+  }
+  size  = st.fSize;
+  mtime = st.fMtime;
+
+  FILE *fp = fopen(file, "r");
+  if ( ! fp) return false;
+
+  std::vector<UChar_t> buf(Chunk);
+  TMD5 md5;
+
+  md5.Update((const UChar_t*) &size, sizeof(size));
+
+  size_t n = fread(&buf[0], 1, Chunk, fp);
+  md5.Update(&buf[0], n);
+
+  if (size > 2 * Chunk)
+  {
+    fseeko(fp, size - Chunk, SEEK_SET);
+    n = fread(&buf[0], 1, Chunk, fp);
+    md5.Update(&buf[0], n);
+  }
+
+  fclose(fp);
+
+  md5.Final();
+  checksum = md5.AsString();
+
+  return true;
+}
+
+void AnalFileIndex::ExpandGlob(const TString& pattern, std::vector<TString>& files)
+{
+  // Wildcards are only supported in the file name, as in TChain::Add().
+
+  TString base = gSystem->BaseName(pattern);
+
+  if ( ! base.Contains("*") && ! base.Contains("?"))
+  {
+    files.push_back(pattern);
+    return;
+  }
+
+  TString dir = gSystem->DirName(pattern);
+  TRegexp re(base, kTRUE);
+
+  std::vector<TString> found;
+
+  void *dh = gSystem->OpenDirectory(dir);
+  if ( ! dh)
+  {
+    fprintf(stderr, "AnalFileIndex::ExpandGlob can not open directory '%s'.\n", dir.Data());
+    return;
+  }
+  while (const char *e = gSystem->GetDirEntry(dh))
+  {
+    TString name(e);
+    if (name.BeginsWith(".")) continue;
+    Ssiz_t len;
+    if (name.Index(re, &len) == 0 && len == name.Length())
+    {
+      found.push_back(dir + "/" + name);
+    }
+  }
+  gSystem->FreeDirectory(dh);
+
+  std::sort(found.begin(), found.end());
+
+  files.insert(files.end(), found.begin(), found.end());
+}
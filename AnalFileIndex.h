@@ -0,0 +1,65 @@
+#ifndef AnalFileIndex_h
+#define AnalFileIndex_h
+
+#include <TString.h>
+
+#include <vector>
+#include <set>
+
+//==============================================================================
+// AnalFileIndex
+//==============================================================================
+
+// Summary of one XrdFar file, kept in a sidecar text file so that the input
+// file does not have to be opened to get entry count and time range.
+// Times are also stored for blocks of BlockSize entries to allow skipping
+// of entry ranges outside of a time window.
+
+class AnalFileIndex
+{
+public:
+  static const Long64_t BlockSize = 65536;
+
+  TString               mFile;
+  Long64_t              mSize;
+  Long64_t              mMTime;
+  TString               mChecksum;   // MD5 of size, first and last MB
+
+  Long64_t              mEntries;
+  Long64_t              mMinOpen,  mMaxOpen;
+  Long64_t              mMinClose, mMaxClose;
+
+  std::set<TString>     mServerDomains;
+
+  std::vector<Long64_t> mBlockMin;   // min of open / close time in block
+  std::vector<Long64_t> mBlockMax;   // max of open / close time in block
+
+  AnalFileIndex();
+
+  Long64_t MinTime() const { return mMinOpen < mMinClose ? mMinOpen : mMinClose; }
+  Long64_t MaxTime() const { return mMaxOpen > mMaxClose ? mMaxOpen : mMaxClose; }
+
+  bool Overlaps(Long64_t min, Long64_t max) const
+  { return MaxTime() >= min && MinTime() <= max; }
+
+  bool BlockOverlaps(Int_t b, Long64_t min, Long64_t max) const
+  { return mBlockMax[b] >= min && mBlockMin[b] <= max; }
+
+  bool Build(const TString& file, const TString& tree_name);
+  bool Read (const TString& idx_file);
+  bool Write(const TString& idx_file) const;
+
+  bool IsCurrent(const TString& file) const;
+
+  // ----------------------------------------------------------------
+
+  // Index file for a data file, see AnalManager::SetFileIndex().
+  static TString SidecarName(const TString& file, const TString& idx_dir="");
+
+  static bool    FileStamp(const TString& file, Long64_t& size, Long64_t& mtime,
+                           TString& checksum);
+
+  static void    ExpandGlob(const TString& pattern, std::vector<TString>& files);
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "SXrdClasses.h"
 
+#include <TEntryList.h>
+
 namespace
 {
   const double OneMB = 1024 * 1024;
@@ -28,20 +30,36 @@ namespace
 AnalFilter::AnalFilter(const TString& name, AnalManager& mgr) :
   mState(false), mName(name), M(mgr),
   mPassCount(0), mTotalCount(0),
-  mEntryList(0)
+  mEntryList(0),
+  mBit(-1),
+  mNeedsIo(false)
 {}
 
+AnalFilter::~AnalFilter()
+{
+  delete mEntryList;
+}
+
+void AnalFilter::UseBranch(const TString& b)
+{
+  mBranches.push_back(b);
+  if (b == "*" || b.BeginsWith("I.")) mNeedsIo = true;
+}
+
 bool AnalFilter::FilterAndStore()
 {
-  mState = Filter();
+  {
+    AnalStageTimer _t(mFilterTime);
+    mState = Filter();
+  }
 
   if (mState)
   {
     ++mPassCount;
     if (mEntryList)
     {
-      // XXX Half cooked, need lots of crap to make this efficient.
-      // mEntryList->Enter(M.GetTreeII(), M.GetTree());
+      // Current sub-list is set in SetEntryListTree(), local index is enough.
+      mEntryList->Enter(M.GetTreeI());
     }
   }
   ++mTotalCount;
@@ -49,6 +67,72 @@ bool AnalFilter::FilterAndStore()
   return mState;
 }
 
+bool AnalFilter::Eval()
+{
+  const ULong64_t bit = BitMask();
+
+  if (M.GetFilterEvalMask() & bit)
+  {
+    return M.GetFilterPassMask() & bit;
+  }
+
+  // Reading of I. on demand is part of the cost of such filters.
+  if (mNeedsIo)
+  {
+    AnalStageTimer _t(mFilterTime);
+    M.LoadIoInfo();
+  }
+  FilterAndStore();
+
+  M.SetFilterResult(bit, mState);
+
+  return mState;
+}
+
+void AnalFilter::AddCounts(const AnalFilter& f)
+{
+  mPassCount  += f.mPassCount;
+  mTotalCount += f.mTotalCount;
+  mFilterTime.Add(f.mFilterTime);
+
+  if (mEntryList && f.mEntryList)
+  {
+    mEntryList->Add(f.mEntryList);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void AnalFilter::SetEntryList(TEntryList* el)
+{
+  if (el != mEntryList) delete mEntryList;
+  mEntryList = el;
+}
+
+void AnalFilter::CreateEntryList()
+{
+  TEntryList *el = new TEntryList(mName, mName);
+  // Do not let it end up in the current directory, e.g. an extractor file.
+  el->SetDirectory(0);
+  SetEntryList(el);
+}
+
+void AnalFilter::SetEntryListTree(TTree* tree)
+{
+  if (mEntryList)
+  {
+    mEntryList->SetTree(tree);
+  }
+}
+
+void AnalFilter::SetEntryListTree(const char* tree_name, const char* file_name)
+{
+  if (mEntryList)
+  {
+    mEntryList->SetTree(tree_name, file_name);
+  }
+}
+
 //==============================================================================
 // User, domain, etc filters
 //==============================================================================
@@ -112,7 +196,7 @@ bool AnFiUsa::Filter()
 
 bool AnFiAodAodsim::Filter()
 {
-  return M.mSlashRe[5] == "AOD" || M.mSlashRe[5] == "AODSIM";
+  return M.PathPart(5) == "AOD" || M.PathPart(5) == "AODSIM";
 }
 
 //------------------------------------------------------------------------------
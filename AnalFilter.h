@@ -3,11 +3,14 @@
 
 #include <TString.h>
 
+#include "AnalTiming.h"
+
 #include <vector>
 #include <set>
 #include <functional>
 
 class TEntryList;
+class TTree;
 
 class SXrdFileInfo;
 class SXrdUserInfo;
@@ -41,6 +44,8 @@ class AnalFilter;
 typedef std::vector<AnalFilter*>  vpAnalFilter_t;
 typedef std::set<AnalFilter*>     spAnalFilter_t;
 
+typedef std::vector<TString>      vTString_t;
+
 
 class AnalFilter
 {
@@ -57,22 +62,68 @@ protected:
 
   TEntryList     *mEntryList;
 
+  AnalStageTime   mFilterTime; // Spent in Filter(), via FilterAndStore().
+
+  Int_t           mBit;        // Index in AnalManager filter masks, -1 if none.
+
+  vTString_t      mBranches;   // Branches / leaves read, "*" for all.
+  bool            mNeedsIo;    // Reads I. branch, set by UseBranch().
+
 public:
   AnalFilter(const TString& name, AnalManager& mgr);
-  virtual ~AnalFilter() {}
+  virtual ~AnalFilter();
 
   const TString& RefName() const { return mName; }
 
   Long64_t GetPassCount()  const { return mPassCount;  }
   Long64_t GetTotalCount() const { return mTotalCount; }
+
+  const AnalStageTime& RefFilterTime() const { return mFilterTime; }
   
 
-  void SetEntryList(TEntryList* el) { mEntryList = el; }
+  // Entry list of passing entries, owned by the filter.
+  void        SetEntryList(TEntryList* el);
+  TEntryList* GetEntryList() const { return mEntryList; }
+  void        CreateEntryList();
+  // Called by AnalManager on every change of the current tree in the chain,
+  // entries are then entered by their local index.
+  void        SetEntryListTree(TTree* tree);
+  void        SetEntryListTree(const char* tree_name, const char* file_name);
+
+  // Declare data used in Filter() / Process(), e.g. "F.mReadStats" or "I.".
+  // Values derived by AnalManager::Filter() (domains, path, duration) are
+  // always available.
+  void UseBranch(const TString& b);
+
+  const vTString_t& RefBranches() const { return mBranches; }
+
+  bool NeedsIoInfo() const { return mNeedsIo; }
+
+  // Assigned by AnalManager::AddExtractor().
+  void      SetBit(Int_t b)  { mBit = b; }
+  Int_t     GetBit()   const { return mBit; }
+  ULong64_t BitMask()  const { return mBit >= 0 ? 1ull << mBit : 0; }
+
+  // Replica of this filter bound to another manager, for parallel processing.
+  virtual AnalFilter* Clone(AnalManager& mgr) const = 0;
+
+  // Adds pass / total counts, filter time and the entry list, if both
+  // have one.
+  void AddCounts(const AnalFilter& f);
+
+  // Restore counts and filter time from a checkpoint.
+  void SetCounts(Long64_t pass, Long64_t total, const AnalStageTime& t)
+  { mPassCount = pass; mTotalCount = total; mFilterTime = t; }
 
   bool Passed() const { return mState; }
 
   bool FilterAndStore();
 
+  // Memoized FilterAndStore(), evaluates at most once per entry and records
+  // the result in the filter masks of the manager. Counts then only include
+  // entries for which the result was needed.
+  bool Eval();
+
   virtual bool Filter() = 0;
 
 
@@ -99,21 +150,30 @@ public:
 class AnFiAnyFoo : public AnalFilter
 {
 public:
-  typedef std::function<bool ()> Foo_t;
+  // Functions get the manager passed in so that they work with replicas.
+  typedef std::function<bool (AnalManager&)> Foo_t;
 
 protected:
   Foo_t      mFunc;
 
 public:
-  AnFiAnyFoo(const TString& n, AnalManager& m, Foo_t f) :
+  // Branches the function reads have to be given, { "*" } for everything.
+  // Derived values are always there, for them pass {}.
+  AnFiAnyFoo(const TString& n, AnalManager& m, Foo_t f,
+             const vTString_t& branches) :
     AnalFilter(n, m),
     mFunc(f)
-  {}
+  { for (auto &b : branches) UseBranch(b); }
   virtual ~AnFiAnyFoo() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiAnyFoo(mName, m, mFunc, mBranches);
+  }
+
   virtual bool Filter()
   {
-    return mFunc();
+    return mFunc(M);
   }
 };
 
@@ -129,9 +189,14 @@ protected:
 
 public:
   AnFiUserRealName(const TString& n, AnalManager& m, const TString& uname) :
-    AnalFilter(n, m), mUName(uname) {}
+    AnalFilter(n, m), mUName(uname) { UseBranch("U.mRealName"); }
   virtual ~AnFiUserRealName() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiUserRealName(mName, m, mUName);
+  }
+
   virtual bool Filter();
 };
 
@@ -148,6 +213,11 @@ public:
     AnalFilter(n, m), mDomain(domain), mType(at) {}
   virtual ~AnFiDomain() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiDomain(mName, m, mDomain, mType);
+  }
+
   virtual bool Filter();
 };
 
@@ -163,6 +233,11 @@ public:
     AnalFilter(n, m), mType(at) {}
   virtual ~AnFiUsa() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiUsa(mName, m, mType);
+  }
+
   virtual bool Filter();
 };
 
@@ -181,6 +256,11 @@ public:
   {}
   virtual ~AnFiDuration() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiDuration(mName, m, mType, mDuration);
+  }
+
   virtual bool Filter();
 };
 
@@ -188,7 +268,7 @@ template<typename TT>
 class AnFiValueCut : public AnalFilter
 {
 public:
-  typedef std::function<TT ()> Foo_t;
+  typedef std::function<TT (AnalManager&)> Foo_t;
 
 protected:
   Foo_t      mFunc;
@@ -196,18 +276,25 @@ protected:
   ValueCut_e mCutType;
 
 public:
-  AnFiValueCut(const TString& n, AnalManager& m, ValueCut_e t, TT v, Foo_t f) :
+  // Branches as for AnFiAnyFoo.
+  AnFiValueCut(const TString& n, AnalManager& m, ValueCut_e t, TT v, Foo_t f,
+               const vTString_t& branches) :
     AnalFilter(n, m),
     mFunc(f), mCutValue(v), mCutType(t)
-  {}
+  { for (auto &b : branches) UseBranch(b); }
   virtual ~AnFiValueCut() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiValueCut<TT>(mName, m, mCutType, mCutValue, mFunc, mBranches);
+  }
+
   virtual bool Filter()
   {
     switch (mCutType)
     {
-      case VC_greater_than: return mFunc() > mCutValue;
-      case VC_less_than:    return mFunc() < mCutValue;
+      case VC_greater_than: return mFunc(M) > mCutValue;
+      case VC_less_than:    return mFunc(M) < mCutValue;
     }
   }
 };
@@ -222,9 +309,15 @@ class AnFiCrappyIov : public AnalFilter
 protected:
 
 public:
-  AnFiCrappyIov(const TString& n, AnalManager& m) : AnalFilter(n, m) {}
+  AnFiCrappyIov(const TString& n, AnalManager& m) : AnalFilter(n, m)
+  { UseBranch("F.mSizeMB"); UseBranch("I."); }
   virtual ~AnFiCrappyIov() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiCrappyIov(mName, m);
+  }
+
   virtual bool Filter();
 };
 
@@ -241,6 +334,11 @@ public:
   AnFiAodAodsim(const TString& n, AnalManager& m) : AnalFilter(n, m) {}
   virtual ~AnFiAodAodsim() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiAodAodsim(mName, m);
+  }
+
   virtual bool Filter();
 };
 
@@ -256,9 +354,15 @@ class AnFiAaaMoniTest : public AnalFilter
 protected:
 
 public:
-  AnFiAaaMoniTest(const TString& n, AnalManager& m) : AnalFilter(n, m) {}
+  AnFiAaaMoniTest(const TString& n, AnalManager& m) : AnalFilter(n, m)
+  { UseBranch("U.mRealName"); }
   virtual ~AnFiAaaMoniTest() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const
+  {
+    return new AnFiAaaMoniTest(mName, m);
+  }
+
   virtual bool Filter();
 };
 
@@ -276,6 +380,8 @@ public:
   XXXX(const TString& n, AnalManager& m) : AnalFilter(n, m) {}
   virtual ~XXXX() {}
 
+  virtual AnalFilter* Clone(AnalManager& m) const { return new XXXX(mName, m); }
+
   virtual bool Filter();
 };
 */
@@ -4,256 +4,3073 @@
 #include "AnExIo.h"
 #include "AnExIov.h"
 #include "AnExCacheSim.h"
+#include "AnalMerger.h"
+#include "AnalStream.h"
 
 #include <TChain.h>
+#include <TChainElement.h>
+#include <TBranch.h>
+#include <TFile.h>
+#include <TTreeCache.h>
 #include <TMath.h>
 #include <TSystem.h>
+#include <TROOT.h>
 #include <TH1.h>
 #include <TDatime.h>
+#include <TEntryList.h>
+#include <TParameter.h>
+#include <TMemFile.h>
+#include <TTree.h>
+#include <TVectorD.h>
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <climits>
+
+#include <sys/resource.h>
+
+namespace
+{
+  vRange_t intersect_ranges(const vRange_t& ra, const vRange_t& rb)
+  {
+    // Both sorted and non-overlapping.
+    vRange_t res;
+    auto a = ra.begin(), b = rb.begin();
+    while (a != ra.end() && b != rb.end())
+    {
+      Long64_t beg = TMath::Max(a->first,  b->first);
+      Long64_t end = TMath::Min(a->second, b->second);
+      if (beg < end) res.push_back(std::make_pair(beg, end));
+
+      if (a->second < b->second) ++a; else ++b;
+    }
+    return res;
+  }
+
+  const ULong64_t kFnvBasis = 14695981039346656037ull;
+
+  ULong64_t fnv1a(const void *data, size_t len, ULong64_t h)
+  {
+    const UChar_t *p = (const UChar_t*) data;
+    for (size_t i = 0; i < len; ++i)
+    {
+      h ^= p[i];
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  TString json_str(const TString& s)
+  {
+    TString r("\"");
+    for (Ssiz_t i = 0; i < s.Length(); ++i)
+    {
+      const char c = s[i];
+      if      (c == '"' || c == '\\') { r += '\\'; r += c; }
+      else if ((UChar_t) c < 0x20)    r += TString::Format("\\u%04x", (UChar_t) c);
+      else                            r += c;
+    }
+    return r + "\"";
+  }
+
+  TString prom_label(const TString& s)
+  {
+    TString r;
+    for (Ssiz_t i = 0; i < s.Length(); ++i)
+    {
+      const char c = s[i];
+      if      (c == '"' || c == '\\') { r += '\\'; r += c; }
+      else if (c == '\n')             r += "\\n";
+      else                            r += c;
+    }
+    return r;
+  }
+
+  ULong64_t fmix64(ULong64_t h)
+  {
+    // Murmur3 finalizer. FNV-1a leaves high bits poorly mixed for short
+    // keys differing at the end, the sample cut uses the whole value.
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+}
+
+//==============================================================================
+
+Int_t  AnalManager::sShardI   = 0;
+Int_t  AnalManager::sNShards  = 1;
+Bool_t AnalManager::sResume   = false;
+Bool_t AnalManager::sIncremental = false;
+
+void AnalManager::SetShard(Int_t i, Int_t n)
+{
+  if (n < 1 || i < 0 || i >= n)
+  {
+    fprintf(stderr, "AnalManager::SetShard bad shard %d of %d. Dying ...\n", i, n);
+    exit(1);
+  }
+  sShardI  = i;
+  sNShards = n;
+}
+
+//==============================================================================
+
+AnalManager::AnalManager(const TString& name,      const TString& out_dir,
+                         const TString& tree_name, const TString& pfx,
+                         bool setup_I_branch) :
+  AnalFilter(name, *this),
+  mInFilePrefix(pfx),
+  mOutDirName(out_dir)
+{
+  if (sNShards > 1)
+  {
+    mOutDirName += TString::Format("/shard-%03d", sShardI);
+  }
+
+  // Incremental: move previous results aside, they get merged in at the end.
+  if (sIncremental && gSystem->AccessPathName(mOutDirName) == false)
+  {
+    if ( ! ReadManifest(mOutDirName))
+    {
+      fprintf(stderr, "No manifest in '%s', can not run incrementally. Dying ...\n",
+              mOutDirName.Data());
+      exit(1);
+    }
+    for (Int_t k = 1; ; ++k)
+    {
+      mPrevOutDir = TString::Format("%s.prev-%d", mOutDirName.Data(), k);
+      if (gSystem->AccessPathName(mPrevOutDir)) break;
+    }
+    if (gSystem->Rename(mOutDirName, mPrevOutDir) != 0)
+    {
+      fprintf(stderr, "Renaming '%s' to '%s' failed. Dying ...\n",
+              mOutDirName.Data(), mPrevOutDir.Data());
+      exit(1);
+    }
+    printf("Incremental run, previous results moved to '%s', %d files done.\n",
+           mPrevOutDir.Data(), (Int_t) mManifest.size());
+  }
+
+  // Make sure out-dir does not exist and then create it.
+  // When resuming it has to exist, checkpoints are checked in Process().
+  if (sResume)
+  {
+    if (gSystem->AccessPathName(mOutDirName))
+    {
+      fprintf(stderr, "Output directory '%s' to resume from does not exist. Dying ...\n",
+              mOutDirName.Data());
+      exit(1);
+    }
+  }
+  else if (gSystem->AccessPathName(mOutDirName) == false)
+  {
+    fprintf(stderr, "Output directory '%s' already exists. Cowardly refusing to use it :(\n",
+            mOutDirName.Data());
+    exit(1);
+  }
+  else if (gSystem->mkdir(mOutDirName, true) == -1)
+  {
+    fprintf(stderr, "Creation of output directory '%s' failed. Dying ...\n");
+    exit(1);
+  }
+
+  mBranchIActive = setup_I_branch;
+
+  mOnTty = isatty(fileno(stdout));
+
+  mChn = new TChain(tree_name);
+
+  SetBranchAddresses();
+}
+
+AnalManager::AnalManager(AnalManager& master, Int_t worker_id) :
+  AnalFilter(TString::Format("%s-w%d", master.mName.Data(), worker_id), *this),
+  AnalManagerConfig(master),
+  mChnN(master.mChnN),
+  mInFilePrefix(master.mInFilePrefix),
+  mOutDirName(master.mOutDirName),
+  mMaster(&master), mWorkerId(worker_id),
+  mSnapWriter(master.mSnapWriter), mNTotal(master.mNTotal), mNUnits(master.mNUnits),
+  mMinT(master.mMinT), mMaxT(master.mMaxT),
+  mTotalDtSec(master.mTotalDtSec), mTotalDtMin(master.mTotalDtMin), mTotalDtHour(master.mTotalDtHour),
+  mTotalDtDay(master.mTotalDtDay), mTotalDtWeek(master.mTotalDtWeek), mTotalDtMonth(master.mTotalDtMonth),
+  mMinDate(master.mMinDate), mMaxDate(master.mMaxDate)
+{
+  // Worker replica: settings of the master, own chain over the same files,
+  // own event buffers and clones of all filters and extractors.
+
+  mChn = new TChain(master.mChn->GetName());
+
+  TIter next(master.mChn->GetListOfFiles());
+  while (TChainElement *el = (TChainElement*) next())
+  {
+    mChn->AddFile(el->GetTitle(), el->GetEntries());
+  }
+
+  SetBranchAddresses();
+
+  auto clone = [this](AnalFilter *f)
+  {
+    AnalFilter *&c = mReplicaMap[f];
+    if ( ! c) c = f->Clone(*this);
+    return c;
+  };
+
+  for (auto f : master.mPreFilters) mPreFilters.push_back(clone(f));
+
+  for (auto mex : master.mAnalExs)
+  {
+    AnalExtractor *ex = mex->Clone(*this);
+    for (auto f : mex->mFilters)     ex->AddFilter(clone(f));
+    for (auto f : mex->mAntiFilters) ex->AddAntiFilter(clone(f));
+    if (mex->IsSkimming())           ex->SetSkim(mex->mSkimBranches);
+    AddExtractor(ex);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+AnalManager::~AnalManager()
+{
+  // In principle should delete all prefilters, filters and extractors.
+  // Workers do it as they own their replicas.
+
+  if (IsWorker())
+  {
+    for (auto ext : mAnalExs)     { ext->CloseFile(); delete ext; }
+    for (auto &fp : mReplicaMap)  { delete fp.second; }
+    delete mChn;
+    delete mIoChn;
+  }
+}
+
+void AnalManager::SetupBranchStatus()
+{
+  // Enable only branches declared by the manager itself, pre-filters,
+  // filters and extractors. A single "*" keeps everything enabled.
+
+  std::set<TString> bs = { "F.mName", "F.mOpenTime", "F.mCloseTime",
+                           "S.mDomain", "U.mFromDomain" };
+  if (IsSampling() && mSampleByUser) bs.insert("U.mRealName");
+
+  auto add = [&](AnalFilter *f)
+  {
+    for (auto &b : f->RefBranches())
+    {
+      if (b == "*" && mPruneBranches)
+      {
+        if ( ! IsWorker())
+          printf("AnalManager::SetupBranchStatus '%s' reads all branches, pruning disabled.\n",
+                 f->RefName().Data());
+        mPruneBranches = false;
+      }
+      bs.insert(b);
+    }
+  };
+
+  for (auto f : mPreFilters) add(f);
+  for (auto f : mAnalFis)    add(f);
+  for (auto f : mAnalExs)    add(f);
+
+  if ( ! mBranchIActive && ! mIoFriend && bs.count("I."))
+  {
+    fprintf(stderr, "I. branch is required by some filter or extractor but is not set up. Dying ...\n");
+    exit(1);
+  }
+
+  if (mIoFriend && (bs.count("I.") || bs.count("*")))
+  {
+    AttachIoFriend();
+  }
+
+  if ( ! mPruneBranches) return;
+
+  // I. is then read on demand by LoadIoInfo(), keep it disabled. Not
+  // possible when another thread does the reading.
+  mDeferIo = mLazyIo && mPipelineDepth == 0 && bs.count("I.");
+
+  mChn->SetBranchStatus("*", 0);
+  mActiveBranches.clear();
+  for (auto &b : bs)
+  {
+    if (mDeferIo && b.BeginsWith("I.")) continue;
+
+    mActiveBranches.push_back(b + "*");
+
+    UInt_t found = 0;
+    mChn->SetBranchStatus(b + "*", 1, &found);
+    if (found == 0)
+    {
+      fprintf(stderr, "AnalManager::SetupBranchStatus no branch matches '%s'.\n", b.Data());
+    }
+  }
+
+  if ( ! IsWorker())
+  {
+    printf("AnalManager::SetupBranchStatus active branches:");
+    for (auto &b : bs) printf(" %s", b.Data());
+    printf("%s\n", mDeferIo ? " (I. read on demand)" : "");
+  }
+}
+
+void AnalManager::SetBranchAddresses()
+{
+  // ?? Can this be done before adding of the files ?
+  mChn->SetBranchAddress("F.", &_fp);
+  mChn->SetBranchAddress("U.", &_up);
+  mChn->SetBranchAddress("S.", &_sp);
+  if (mBranchIActive || mIoChn)
+    mChn->SetBranchAddress("I.", &_ip);
+}
+
+void AnalManager::AttachIoFriend()
+{
+  // Friend chain with the same file boundaries, so entry numbers within
+  // a file are the same for both, see SetupTreeRead().
+
+  if (mIoChn) return;
+
+  mIoChn = new TChain(TString(mChn->GetName()) + "Io");
+
+  TIter next(mChn->GetListOfFiles());
+  while (TChainElement *el = (TChainElement*) next())
+  {
+    mIoChn->AddFile(IoFriendName(el->GetTitle(), mIoFriendDir), el->GetEntries());
+  }
+
+  mChn->AddFriend(mIoChn);
+
+  SetBranchAddresses();
+
+  if ( ! IsWorker())
+  {
+    printf("AnalManager::AttachIoFriend I. from %d friend files.\n",
+           mIoChn->GetListOfFiles()->GetEntries());
+  }
+}
+
+//==============================================================================
+
+void AnalManager::SetIoFriend(bool use, const TString& io_dir)
+{
+  if (use && mBranchIActive)
+  {
+    fprintf(stderr, "AnalManager::SetIoFriend I. is set up in the main tree, construct with setup_I_branch = false. Dying ...\n");
+    exit(1);
+  }
+
+  mIoFriend    = use;
+  mIoFriendDir = io_dir;
+}
+
+TString AnalManager::IoFriendName(const TString& file, const TString& io_dir)
+{
+  TString dir = io_dir.IsNull() ? TString(gSystem->DirName(file)) + "/io" : io_dir;
+
+  return dir + "/" + gSystem->BaseName(file);
+}
+
+//------------------------------------------------------------------------------
+
+void AnalManager::SetSampling(Double_t fraction, bool by_user, ULong64_t seed)
+{
+  if (fraction <= 0 || fraction > 1)
+  {
+    fprintf(stderr, "AnalManager::SetSampling fraction %f not in (0, 1]. Dying ...\n", fraction);
+    exit(1);
+  }
+
+  mSampleFraction  = fraction;
+  mSampleByUser    = by_user;
+  mSampleBasis     = fnv1a(&seed, sizeof(seed), kFnvBasis);
+  mSampleThreshold = fraction < 1 ? (ULong64_t) (fraction * 18446744073709551616.0) : 0;
+}
+
+ULong64_t AnalManager::SampleKey() const
+{
+  // NUL after the user name keeps "ab" + "c" apart from "a" + "bc".
+
+  ULong64_t h = mSampleBasis;
+  if (mSampleByUser) h = fnv1a(U.mRealName.Data(), U.mRealName.Length() + 1, h);
+  h = fnv1a(F.mName.Data(), F.mName.Length(), h);
+
+  return fmix64(h);
+}
+
+void AnalManager::CountSampleKey()
+{
+  // Entry passed the manager, mSamplePassBefore has the other counts from
+  // before its filters and extractors ran.
+
+  std::vector<Long64_t> &v = mSampleKeyPass[SampleKey()];
+  v.resize(1 + mAnalExs.size() + mAnalFis.size());
+
+  size_t c = 0;
+  v[c++] += 1;
+  for (auto ext : mAnalExs) { v[c] += ext->GetPassCount() - mSamplePassBefore[c]; ++c; }
+  for (auto fil : mAnalFis)
+  {
+    const size_t fc = c + fil->GetBit();
+    v[fc] += fil->GetPassCount() - mSamplePassBefore[fc];
+  }
+}
+
+Double_t AnalManager::SampleVariance(size_t c) const
+{
+  // Keys are kept independently with probability f, key k with total T_k
+  // adds (1 - f) / f^2 T_k^2, estimated by the sum over kept keys.
+
+  const Double_t f = mSampleFraction;
+
+  Double_t sum = 0;
+  for (auto &kv : mSampleKeyPass)
+  {
+    const Double_t t = kv.second[c];
+    sum += t * t;
+  }
+  return sum * (1 - f) / (f * f);
+}
+
+//------------------------------------------------------------------------------
+
+void AnalManager::SetFileIndex(bool use, const TString& idx_dir)
+{
+  mUseFileIndex = use;
+  mIndexDir     = idx_dir.IsNull() ? TString(gSystem->WorkingDirectory()) + "/anidx" : idx_dir;
+
+  if (use && gSystem->AccessPathName(mIndexDir) && gSystem->mkdir(mIndexDir, true) != 0)
+  {
+    fprintf(stderr, "AnalManager::SetFileIndex can not create '%s'. Dying ...\n", mIndexDir.Data());
+    exit(1);
+  }
+}
+
+void AnalManager::SetTimeWindow(Long64_t min, Long64_t max)
+{
+  if (mChn->GetListOfFiles()->GetEntries() > 0)
+  {
+    fprintf(stderr, "Time window has to be set before adding files! Dying ...\n");
+    exit(1);
+  }
+
+  mUseFileIndex = true;
+  mWindowMin    = min;
+  mWindowMax    = max;
+}
+
+void AnalManager::AddFile(const TString& files)
+{
+  if ( ! mAnalExs.empty())
+  {
+    fprintf(stderr, "Adding files after analyses have been registered is wrong! Dying ...\n");
+    exit(1);
+  }
+
+  if ( ! mUseFileIndex && mManifest.empty())
+  {
+    mChn->Add(mInFilePrefix + files);
+    return;
+  }
+
+  std::vector<TString> names;
+  AnalFileIndex::ExpandGlob(mInFilePrefix + files, names);
+
+  if ( ! mManifest.empty())
+  {
+    FilterProcessedFiles(names);
+  }
+
+  if ( ! mUseFileIndex)
+  {
+    for (auto &n : names) mChn->Add(n);
+    return;
+  }
+
+  // Read existing indices, rebuild missing or stale ones in parallel.
+
+  const Int_t N = names.size();
+
+  std::vector<AnalFileIndex> idcs(N);
+  std::vector<Int_t>         to_build;
+
+  for (Int_t i = 0; i < N; ++i)
+  {
+    TString sidecar = AnalFileIndex::SidecarName(names[i], mIndexDir);
+    if ( ! idcs[i].Read(sidecar) || ! idcs[i].IsCurrent(names[i]))
+    {
+      to_build.push_back(i);
+    }
+  }
+
+  if ( ! to_build.empty())
+  {
+    printf("AnalManager::AddFile building index for %d of %d files ...\n",
+           (Int_t) to_build.size(), N);
+
+    ROOT::EnableThreadSafety();
+
+    std::atomic<Int_t>       next(0);
+    std::vector<std::thread> threads;
+    // hardware_concurrency() may be 0 when unknown.
+    const Int_t n_threads = TMath::Min((Int_t) std::max(1u, std::thread::hardware_concurrency()),
+                                       (Int_t) to_build.size());
+    for (Int_t t = 0; t < n_threads; ++t)
+    {
+      threads.emplace_back([&]()
+      {
+        Int_t k;
+        while ((k = next++) < (Int_t) to_build.size())
+        {
+          const Int_t i = to_build[k];
+          if (idcs[i].Build(names[i], mChn->GetName()))
+          {
+            idcs[i].Write(AnalFileIndex::SidecarName(names[i], mIndexDir));
+          }
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+  }
+
+  // Add files with known entry counts, record entry ranges within the window.
+
+  for (Int_t i = 0; i < N; ++i)
+  {
+    AnalFileIndex &idx = idcs[i];
+
+    if (idx.mSize < 0)
+    {
+      fprintf(stderr, "AnalManager::AddFile no index for '%s', skipping it.\n", names[i].Data());
+      continue;
+    }
+    if ( ! idx.Overlaps(mWindowMin, mWindowMax))
+    {
+      printf("AnalManager::AddFile '%s' outside of time window, skipping it.\n", names[i].Data());
+      continue;
+    }
+
+    const Long64_t offset = mChn->GetEntries();
+
+    mChn->AddFile(names[i], idx.mEntries);
+    mFileIndices.push_back(idx);
+
+    for (Int_t b = 0; b < (Int_t) idx.mBlockMin.size(); ++b)
+    {
+      if ( ! idx.BlockOverlaps(b, mWindowMin, mWindowMax)) continue;
+
+      Long64_t beg = offset + b * AnalFileIndex::BlockSize;
+      Long64_t end = offset + TMath::Min((b + 1) * AnalFileIndex::BlockSize, idx.mEntries);
+
+      if ( ! mEntryRanges.empty() && mEntryRanges.back().second == beg)
+        mEntryRanges.back().second = end;
+      else
+        mEntryRanges.push_back(std::make_pair(beg, end));
+    }
+  }
+
+  mHasEntryRanges = true;
+}
+
+void AnalManager::AddPreFilter(AnalFilter* flt)
+{
+  mPreFilters.push_back(flt);
+}
+
+void AnalManager::AddExtractor(AnalExtractor* ext)
+{
+  // Bits are assigned in order of addition, same as OrderedFilters(), so
+  // worker replicas get the same ones.
+
+  auto add = [this](AnalFilter *f)
+  {
+    if ( ! mAnalFis.insert(f).second) return;
+
+    if (mAnalFis.size() > 64)
+    {
+      fprintf(stderr, "AnalManager::AddExtractor more than 64 distinct filters. Dying ...\n");
+      exit(1);
+    }
+    f->SetBit(mAnalFis.size() - 1);
+  };
+
+  mAnalExs.push_back(ext);
+  for (auto f : ext->mFilters)     add(f);
+  for (auto f : ext->mAntiFilters) add(f);
+
+  ext->SetupMasks();
+}
+
+//==============================================================================
+
+void AnalManager::ScanEdgeTimes(Long64_t scan_entries)
+{
+  printf("AnalManager::ScanEdgeTimes entered ...\n");
+
+  Long64_t N = mChn->GetEntries();
+
+  printf("Chain has %lld entries.\n", N);
+
+  if (N == 0)
+  {
+    fprintf(stderr, "AnalManager::ScanEdgeTimes chain is empty, no edge times. Dying ...\n");
+    exit(1);
+  }
+
+  if (scan_entries > N) scan_entries = N;
+
+  Long64_t mo, mc, Mo, Mc;
+  Long64_t imo, imc, iMo, iMc;
+
+  mChn->GetEntry(0);
+  mo = Mo = F.mOpenTime;
+  mc = Mc = F.mCloseTime;
+  imo = imc = iMo = iMc = 0;
+
+  for (Long64_t i = 1; i < scan_entries; ++i)
+  {
+    mChn->GetEntry(i);
+    if (F.mOpenTime  < mo) { mo = F.mOpenTime;  imo = i; }
+    if (F.mCloseTime < mc) { mc = F.mCloseTime; imc = i; }
+  }
+
+  for (Long64_t i = N - scan_entries; i < N; ++i)
+  {
+    mChn->GetEntry(i);
+    if (F.mOpenTime  > Mo) { Mo = F.mOpenTime;  iMo = i; }
+    if (F.mCloseTime > Mc) { Mc = F.mCloseTime; iMc = i; }
+  }
+
+  printf("Min time open %lld (%lld), close %lld (%lld)\n", mo, imo, mc, imc);
+  printf("Max time open %lld (%lld), close %lld (%lld)\n", Mo, iMo, Mc, iMc);
+
+  SetEdgeTimes(TMath::Min(mo, mc), TMath::Max(Mo, Mc), true);
+
+  printf("  // mgr.SetEdgeTimes(%lld, %lld);\n", mMinT, mMaxT);
+
+  printf("AnalManager::ScanEdgeTimes finished.\n");
+}
+
+void AnalManager::ScanEdgeTimesExact(Int_t n_threads, Double_t reject_frac)
+{
+  // Go over all entries of all files, reading only F.mOpenTime and
+  // F.mCloseTime. Files are distributed over n_threads threads, 0 means
+  // one per core.
+  // With reject_frac > 0, this fraction of all open / close times is
+  // dropped on each side, in whole hours, before setting the edges.
+
+  printf("AnalManager::ScanEdgeTimesExact entered ...\n");
+
+  // hardware_concurrency() may be 0 when unknown.
+  if (n_threads <= 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  ROOT::EnableThreadSafety();
+
+  struct Result
+  {
+    Long64_t                     min = LLONG_MAX, max = LLONG_MIN;
+    Long64_t                     n   = 0;
+    std::map<Long64_t, Long64_t> hours;
+  };
+
+  const Int_t        n_files = mChn->GetListOfFiles()->GetEntries();
+  const TString      tree_name(mChn->GetName());
+  std::atomic<Int_t> next_file(0);
+  std::vector<Result>      results(n_threads);
+  std::vector<std::thread> threads;
+
+  for (Int_t t = 0; t < n_threads; ++t)
+  {
+    threads.emplace_back([&, t]()
+    {
+      Result       &r = results[t];
+      SXrdFileInfo  fi, *fip = &fi;
+
+      Int_t fn;
+      while ((fn = next_file++) < n_files)
+      {
+        const char *fname = mChn->GetListOfFiles()->At(fn)->GetTitle();
+
+        TFile *file = TFile::Open(fname);
+        TTree *tree = file ? (TTree*) file->Get(tree_name) : 0;
+        if ( ! tree)
+        {
+          fprintf(stderr, "AnalManager::ScanEdgeTimesExact can not read '%s'.\n", fname);
+          delete file;
+          continue;
+        }
+
+        tree->SetBranchStatus("*", 0);
+        tree->SetBranchStatus("F.mOpenTime",  1);
+        tree->SetBranchStatus("F.mCloseTime", 1);
+        tree->SetBranchAddress("F.", &fip);
+
+        const Long64_t N = tree->GetEntries();
+        for (Long64_t i = 0; i < N; ++i)
+        {
+          tree->GetEntry(i);
+
+          for (Long64_t x : { fi.mOpenTime, fi.mCloseTime })
+          {
+            if (x < r.min) r.min = x;
+            if (x > r.max) r.max = x;
+            if (reject_frac > 0) ++r.hours[x / 3600];
+          }
+        }
+        r.n += N;
+
+        delete file;
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  Result all;
+  for (auto &r : results)
+  {
+    if (r.min < all.min) all.min = r.min;
+    if (r.max > all.max) all.max = r.max;
+    all.n += r.n;
+    for (auto &h : r.hours) all.hours[h.first] += h.second;
+  }
+
+  printf("Scanned %lld entries in %d files.\n", all.n, n_files);
+
+  if (all.n == 0)
+  {
+    fprintf(stderr, "AnalManager::ScanEdgeTimesExact no entries scanned, no edge times. Dying ...\n");
+    exit(1);
+  }
+  printf("Min time %lld, max time %lld\n", all.min, all.max);
+
+  Long64_t min = all.min, max = all.max;
+
+  if (reject_frac > 0)
+  {
+    const Long64_t n_rej = reject_frac * 2 * all.n;
+    Long64_t       sum;
+
+    sum = 0;
+    for (auto h = all.hours.begin(); h != all.hours.end(); ++h)
+    {
+      sum += h->second;
+      if (sum > n_rej) { min = TMath::Max(min, h->first * 3600); break; }
+    }
+    sum = 0;
+    for (auto h = all.hours.rbegin(); h != all.hours.rend(); ++h)
+    {
+      sum += h->second;
+      if (sum > n_rej) { max = TMath::Min(max, h->first * 3600 + 3599); break; }
+    }
+
+    printf("After rejection of %.4f%% on each side: min %lld, max %lld\n",
+           100 * reject_frac, min, max);
+  }
+
+  SetEdgeTimes(min, max, true);
+
+  printf("  // mgr.SetEdgeTimes(%lld, %lld);\n", mMinT, mMaxT);
+
+  printf("AnalManager::ScanEdgeTimesExact finished.\n");
+}
+
+void AnalManager::SetEdgeTimesFromIndex()
+{
+  // Edges from sidecar indices of added files, clamped to the time window.
+
+  if (mFileIndices.empty())
+  {
+    fprintf(stderr, "AnalManager::SetEdgeTimesFromIndex no file indices, use SetFileIndex(). Dying ...\n");
+    exit(1);
+  }
+
+  Long64_t min = LLONG_MAX, max = LLONG_MIN;
+  for (auto &idx : mFileIndices)
+  {
+    min = TMath::Min(min, idx.MinTime());
+    max = TMath::Max(max, idx.MaxTime());
+  }
+
+  SetEdgeTimes(TMath::Max(min, mWindowMin), TMath::Min(max, mWindowMax), true);
+}
+
+void AnalManager::SetEdgeTimes(Long64_t min, Long64_t max, bool verbose)
+{
+  if ( ! mPrevOutDir.IsNull())
+  {
+    // Keep bins of previous results, max is already rounded.
+    printf("Incremental run, time Min %lld -- %lld Max extended to previous results.\n", min, max);
+    min = mPrevMinT;
+    max = TMath::Max(max, mPrevMaxT - 1);
+  }
+
+  printf("Time Min %lld -- %lld Max\n", min, max);
+
+  // round to nearest hour
+  mMinT = min - min % 3600;
+  mMaxT = max + (3600 - max % 3600);
+
+  printf("  Rounded Min %lld -- %lld Max\n", mMinT, mMaxT);
+
+  mTotalDtSec  = mMaxT - mMinT;
+  mTotalDtMin  = mTotalDtSec  / 60;
+  mTotalDtHour = mTotalDtMin  / 60;
+  mTotalDtDay  = mTotalDtHour / 24.0;
+  mTotalDtWeek = mTotalDtDay  / 7;
+  mTotalDtMonth= mTotalDtDay  / 30.4375; // = 365.25 / 12
+
+  TDatime dt;
+  dt.Set(mMinT);
+  mMinDate.Form("%d-%02d-%02d %02d:%02d PST",
+                dt.GetYear(), dt.GetMonth(), dt.GetDay(), dt.GetHour(), dt.GetMinute());
+  dt.Set(mMaxT);
+  mMaxDate.Form("%d-%02d-%02d %02d:%02d PST",
+                dt.GetYear(), dt.GetMonth(), dt.GetDay(), dt.GetHour(), dt.GetMinute());
+
+  printf("  Duration = %lld s, %lld min, %lld hours,\n"
+         "             %.2f days, %.2f weeks, %.2f months\n"
+         "  From %s to %s\n",
+         mTotalDtSec, mTotalDtMin,  mTotalDtHour,
+         mTotalDtDay, mTotalDtWeek, mTotalDtMonth,
+         mMinDate.Data(), mMaxDate.Data());
+}
+
+//==============================================================================
+
+bool AnalManager::Filter()
+{
+  // Extract commonly used data & filter out crap. In pipelined mode this
+  // is done in the derive stage.
+
+  // Dropped entries may only have the sample keys read, see LoadEntry().
+  if (IsSampling() && ! InSample())  return false;
+
+  if (mPipelineDepth == 0)
+  {
+    mDeriver.Derive(F, U, S, mDt, mSDomain, mUDomain, mPathParts);
+  }
+
+  // Pathological time open / close / duration. Times beyond max can only
+  // come from outlier rejection in ScanEdgeTimesExact().
+  if (F.mCloseTime < mMinT || F.mOpenTime < mMinT || mDt > 1e6 ||
+      F.mOpenTime + mDt >= mMaxT)
+  {
+    printf("YEBO Event=%lld CloseTime=%lld OpenTime=%lld delta_t=%f ... skipping.\n",
+           mChnI, F.mCloseTime, F.mOpenTime, mDt);
+    return false;
+  }
+
+  for (auto flt : mPreFilters)
+  {
+    if (mDeferIo && flt->NeedsIoInfo()) LoadIoInfo();
+
+    if ( ! flt->Filter())  return false;
+  }
+
+  return true;
+}
+
+//==============================================================================
+
+void AnalManager::NotifyTreeChange()
+{
+  bool first = (mTreeNumber == -1);
+
+  mTreeNumber = mChn->GetTreeNumber();
+  mTree       = mChn->GetTree();
+
+  SetupTreeRead(first);
+
+  if (mStoreEntryLists)
+  {
+    SetEntryListTree(mTree);
+    for (auto f : mAnalFis) f->SetEntryListTree(mTree);
+    for (auto e : mAnalExs) e->SetEntryListTree(mTree);
+  }
+}
+
+void AnalManager::SetupTreeRead(bool first)
+{
+  // Reading side of a tree change, in the reader thread when pipelined.
+
+  mTreeBeg   = mChn->GetChainOffset();
+  mTreeEnd   = mTreeBeg + mChn->GetTree()->GetEntries();
+  mTreeNRead = 0;
+
+  mBranchI = mDeferIo ? mChn->GetTree()->GetBranch("I.") : 0;
+
+  mSampleBranches.clear();
+  if (IsSampling() && mPipelineDepth == 0)
+  {
+    mSampleBranches.push_back(mChn->GetTree()->GetBranch("F.mName"));
+    if (mSampleByUser) mSampleBranches.push_back(mChn->GetTree()->GetBranch("U.mRealName"));
+
+    // Not split, read whole entries.
+    for (auto b : mSampleBranches) if ( ! b) { mSampleBranches.clear(); break; }
+  }
+
+  if (mIoChn)
+  {
+    // TChain::LoadTree() loads the friend as well.
+    TTree *ft = mIoChn->GetTree();
+    if ( ! ft || ft->GetEntries() != mChn->GetTree()->GetEntries())
+    {
+      fprintf(stderr, "I. friend of '%s' is missing or not aligned by entry. Dying ...\n",
+              mChn->GetCurrentFile()->GetName());
+      exit(1);
+    }
+  }
+
+  if (mImtOn) mChn->GetTree()->SetImplicitMT(true);
+
+  if (first && mImtThreads >= 0 && ! mImtOn)
+  {
+    TTree::TClusterIterator ci = mChn->GetTree()->GetClusterIterator(0);
+    ci();
+    mImtStartAt = mNRead + TMath::Max(ci.GetNextEntry(), (Long64_t) mCacheLearnEntries);
+  }
+
+  if (first && mCacheSize > 0)
+  {
+    // TChain carries the cache and its branch list over to next files.
+    mChn->SetCacheSize(mCacheSize);
+    if (mCacheLearnEntries > 0)
+    {
+      mChn->SetCacheLearnEntries(mCacheLearnEntries);
+    }
+    else
+    {
+      if (mActiveBranches.empty())
+      {
+        mChn->AddBranchToCache("*", true);
+      }
+      for (auto &b : mActiveBranches)
+      {
+        if (mIoChn && b.BeginsWith("I.")) continue;
+        mChn->AddBranchToCache(b, true);
+      }
+      mChn->StopCacheLearningPhase();
+    }
+
+    // The friend is read from its own files, with its own cache. It only
+    // holds I., nothing to learn.
+    if (mIoChn)
+    {
+      mIoChn->SetCacheSize(mCacheSize);
+      mIoChn->AddBranchToCache("*", true);
+      mIoChn->StopCacheLearningPhase();
+    }
+  }
+
+  if (mPrefetcher)
+  {
+    TObject *next = mChn->GetListOfFiles()->At(mChn->GetTreeNumber() + 1);
+    if (next) mPrefetcher->Request(next->GetTitle());
+    if (next && mIoChn) mPrefetcher->Request(IoFriendName(next->GetTitle(), mIoFriendDir));
+  }
+}
+
+void AnalManager::CollectCacheStats()
+{
+  // Called before LoadTree() moves to another file and at the end of the
+  // loop, the cache is deleted with its file. ROOT only gives the hit rate
+  // of a file, it is weighted by entries read from it.
+
+  TFile *file = mChn->GetCurrentFile();
+  TTreeCache *tc = file ? (TTreeCache*) mChn->GetReadCache(file) : 0;
+  if (tc && mTreeNRead > 0)
+  {
+    mCacheHits  += tc->GetEfficiencyRel() * mTreeNRead;
+    mCacheNRead += mTreeNRead;
+  }
+  mTreeNRead = 0;
+
+  mCacheHitRate = mCacheNRead > 0 ? mCacheHits / mCacheNRead : 0;
+}
+
+void AnalManager::SetEntryListTrees(Int_t tree_number)
+{
+  // Pipelined mode: the reader can be in a later file already and its tree
+  // gone, use names from the chain.
+
+  mTreeNumber = tree_number;
+
+  if ( ! mStoreEntryLists) return;
+
+  TChainElement *el = (TChainElement*) mChn->GetListOfFiles()->At(tree_number);
+
+  SetEntryListTree(el->GetName(), el->GetTitle());
+  for (auto f : mAnalFis) f->SetEntryListTree(el->GetName(), el->GetTitle());
+  for (auto e : mAnalExs) e->SetEntryListTree(el->GetName(), el->GetTitle());
+}
+
+void AnalManager::StepImtCalib()
+{
+  // Timing starts once the first cluster is read, see SetupTreeRead().
+
+  if (mNRead == mImtStartAt)
+  {
+    mImtNReadS    = mNRead;
+    mImtNBytesS   = mNBytes;
+    mImtReadWallS = mReadTime.f_wall;
+    mImtWallS     = std::chrono::duration<double>(std::chrono::steady_clock::now() - mLoopStart).count() +
+                    mResumedWall;
+  }
+
+  if (mImtCalibEntries == 0 || mNRead >= mImtStartAt + mImtCalibEntries) EnableImt();
+}
+
+void AnalManager::EnableImt()
+{
+  // Statistics so far are the calibration without implicit MT.
+
+  mImtNRead0    = mNRead;
+  mImtNBytes0   = mNBytes;
+  mImtReadWall0 = mReadTime.f_wall;
+  mImtWall0     = std::chrono::duration<double>(std::chrono::steady_clock::now() - mLoopStart).count() +
+                  mResumedWall;
+
+  ROOT::EnableImplicitMT(mImtThreads);
+
+  // Trees loaded before have it off.
+  if (mChn->GetTree()) mChn->GetTree()->SetImplicitMT(true);
+
+  mImtOn = true;
+
+  printf("AnalManager::EnableImt implicit MT with %u threads after %lld entries.\n",
+         ROOT::GetThreadPoolSize(), mNRead);
+}
+
+void AnalManager::LoadEntry()
+{
+  if (mImtThreads >= 0 && ! mImtOn) StepImtCalib();
+
+  AnalStageTimer _t(mReadTime);
+
+  if (mChnI < mTreeBeg || mChnI >= mTreeEnd) CollectCacheStats();
+
+  mTreeI = mChn->LoadTree(mChnI);
+
+  if (mChn->GetTreeNumber() != mTreeNumber)
+  {
+    NotifyTreeChange();
+  }
+
+  // Sampling: key branches first, the rest only for kept entries.
+  // The full read unpacks the key branches again, they are counted once.
+  bool  keep      = true;
+  Int_t key_bytes = 0;
+  if ( ! mSampleBranches.empty())
+  {
+    for (auto b : mSampleBranches) key_bytes += b->GetEntry(mTreeI);
+    mNBytes += key_bytes;
+    keep = InSample();
+  }
+
+  if (keep) mNBytes += mChn->GetEntry(mChnI) - key_bytes;
+
+  mIoLoaded = ! mDeferIo;
+
+  ++mNRead;
+  ++mTreeNRead;
+}
+
+void AnalManager::LoadIoInfo()
+{
+  // Branch is disabled, getall forces reading of it and its sub-branches.
+
+  if (mIoLoaded) return;
+
+  AnalStageTimer _t(mReadTime);
+
+  mNBytes += mBranchI->GetEntry(mTreeI, 1);
+
+  mIoLoaded = true;
+}
+
+void AnalManager::ProcessEntry()
+{
+  LoadEntry();
+
+  ProcessLoadedEntry();
+}
+
+void AnalManager::ProcessLoadedEntry()
+{
+  // Extract commonly used data & filter out crap
+  if ( ! FilterAndStore())
+  {
+    return;
+  }
+
+  if (IsSampling())
+  {
+    mSamplePassBefore.resize(1 + mAnalExs.size() + mAnalFis.size());
+    size_t c = 1;
+    for (auto ext : mAnalExs) mSamplePassBefore[c++] = ext->GetPassCount();
+    for (auto fil : mAnalFis) mSamplePassBefore[c + fil->GetBit()] = fil->GetPassCount();
+  }
+
+  mFiEvalMask = mFiPassMask = 0;
+
+  // Filters are evaluated by extractors as needed, see
+  // AnalExtractor::Filter(). Exact mode gets them all counted.
+  if (mExactFilterCounts)
+  {
+    for (auto flt : mAnalFis) flt->Eval();
+  }
+
+  // Call extractors
+  if (mFanOut)
+  {
+    mFanExs.clear();
+    for (auto ext : mAnalExs)
+    {
+      if (ext->FilterAndStore())
+      {
+        if (mDeferIo && ext->NeedsIoInfo()) LoadIoInfo();
+        mFanExs.push_back(ext);
+      }
+    }
+    mFanOut->Run(mFanExs.size());
+  }
+  else
+  {
+    for (auto ext : mAnalExs)
+    {
+      if (ext->FilterAndStore())
+      {
+        if (mDeferIo && ext->NeedsIoInfo()) LoadIoInfo();
+        RunExtractor(ext);
+      }
+    }
+  }
+
+  ++mFiMaskCounts[std::make_pair(mFiEvalMask, mFiPassMask)];
+
+  if (IsSampling()) CountSampleKey();
+}
+
+bool AnalManager::NextRange(std::pair<Long64_t, Long64_t>& r)
+{
+  if (mWorkQueue) return mWorkQueue->Next(mWorkerId, r);
+
+  if (mRangeI >= mRangesToDo.size()) return false;
+
+  r = mRangesToDo[mRangeI++];
+  return true;
+}
+
+void AnalManager::RunExtractor(AnalExtractor* ext)
+{
+  {
+    AnalStageTimer _t(ext->mProcessTime);
+    ext->Process();
+  }
+
+  if (ext->IsSkimming()) ext->FillSkim();
+}
+
+void AnalManager::ProcessRange(Long64_t beg, Long64_t end)
+{
+  // At least 1, small chains (skims, entry lists) have fewer than 10k entries.
+  const Int_t NDiv = TMath::Max(1, (Int_t) TMath::Power(10, TMath::Floor(TMath::Log10(mChnN) - 4)));
+
+  const Long64_t n_done_before = mNDone;
+
+  for (mChnI = beg; mChnI < end; ++mChnI)
+  {
+    // Progress report
+    if (mChnI % NDiv == 0)
+    {
+      ReportProgress(n_done_before + mChnI - beg);
+    }
+
+    ProcessEntry();
+  }
+
+  mNDone = n_done_before + end - beg;
+}
+
+void AnalManager::ReportProgress(Long64_t n_done)
+{
+  // Also writes checkpoints, n_done entries of assigned ranges are done.
+
+  if (mCheckpointInterval > 0 &&
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastCheckpoint).count() > mCheckpointInterval)
+  {
+    WriteCheckpoint(n_done);
+  }
+
+  if (SnapshotDue(n_done))
+  {
+    WriteSnapshot(n_done);
+  }
+
+  if ( ! IsWorker() && MetricsDue())
+  {
+    WriteMetrics(n_done, TFile::GetFileBytesRead(), {});
+  }
+
+  // printf("%lld ", mChnI);
+  if (IsWorker())
+  {
+    mNDone = n_done;
+    if ( ! mMaster->mMetricsFile.IsNull()) PublishCounts();
+  }
+  else if (mOnTty)
+  {
+    printf("\x1b[2K\x1b[31mProgress: %5.2f%%\x1b[0m\x1b[0E", 100*(double)mChnI/mChnN);
+    fflush(stdout);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Pipelined event loop
+//------------------------------------------------------------------------------
+
+void AnalManager::ReadStage(AnalQueue<AnalEvent*>& in, AnalQueue<AnalEvent*>& out)
+{
+  // Reads into own buffers with fixed branch addresses and swaps their
+  // contents into free events. Only touches the chain and read statistics.
+
+  AnalEvent rd;
+  SXrdFileInfo   *fp = &rd.F;
+  SXrdUserInfo   *up = &rd.U;
+  SXrdServerInfo *sp = &rd.S;
+  SXrdIoInfo     *ip = &rd.I;
+
+  mChn->SetBranchAddress("F.", &fp);
+  mChn->SetBranchAddress("U.", &up);
+  mChn->SetBranchAddress("S.", &sp);
+  if (mBranchIActive || mIoChn)
+    mChn->SetBranchAddress("I.", &ip);
+
+  Int_t tree_number = -1;
+
+  std::pair<Long64_t, Long64_t> r;
+  while (NextRange(r))
+  {
+    for (Long64_t i = r.first; i < r.second; ++i)
+    {
+      AnalEvent *ev = in.Pop();
+
+      if (mImtThreads >= 0 && ! mImtOn) StepImtCalib();
+
+      {
+        AnalStageTimer _t(mReadTime);
+
+        if (i < mTreeBeg || i >= mTreeEnd) CollectCacheStats();
+
+        ev->f_tree_i = mChn->LoadTree(i);
+
+        if (mChn->GetTreeNumber() != tree_number)
+        {
+          bool first  = (tree_number == -1);
+          tree_number = mChn->GetTreeNumber();
+          SetupTreeRead(first);
+        }
+
+        mNBytes += mChn->GetEntry(i);
+      }
+      ++mNRead;
+      ++mTreeNRead;
+
+      swap_content(ev->F, rd.F);
+      swap_content(ev->U, rd.U);
+      swap_content(ev->S, rd.S);
+      swap_content(ev->I, rd.I);
+      ev->f_chain_i     = i;
+      ev->f_tree_number = tree_number;
+
+      out.Push(ev);
+    }
+  }
+
+  out.Push(0);
+
+  // While the last file is still open.
+  CollectCacheStats();
+
+  // Local pointers go out of scope.
+  SetBranchAddresses();
+}
+
+void AnalManager::DeriveStage(AnalQueue<AnalEvent*>& in, AnalQueue<AnalEvent*>& out)
+{
+  // Own deriver, regexps are not shared with the extract stage.
+
+  AnalEventDeriver deriver;
+
+  while (AnalEvent *ev = in.Pop())
+  {
+    {
+      AnalStageTimer _t(mDeriveTime);
+      deriver.Derive(*ev);
+    }
+    out.Push(ev);
+  }
+
+  out.Push(0);
+}
+
+void AnalManager::SwapEvent(AnalEvent& ev)
+{
+  // Makes ev the current entry, the previous contents go back with ev.
+
+  swap_content(F, ev.F);
+  swap_content(U, ev.U);
+  swap_content(S, ev.S);
+  swap_content(I, ev.I);
+
+  std::swap(mDt,       ev.f_dt);
+  std::swap(mSDomain,  ev.f_s_domain);
+  std::swap(mUDomain,  ev.f_u_domain);
+  std::swap(mPathParts, ev.f_path);
+
+  mChnI  = ev.f_chain_i;
+  mTreeI = ev.f_tree_i;
+}
+
+void AnalManager::ProcessPipelined()
+{
+  // Reader and derive stages get threads, filters and extractors run here.
+  // Queues can hold all events plus the end marker, only pops ever wait.
+
+  // At least 1, small chains (skims, entry lists) have fewer than 10k entries.
+  const Int_t NDiv = TMath::Max(1, (Int_t) TMath::Power(10, TMath::Floor(TMath::Log10(mChnN) - 4)));
+
+  ROOT::EnableThreadSafety();
+
+  std::vector<AnalEvent> events(mPipelineDepth);
+
+  AnalQueue<AnalEvent*> free_q(mPipelineDepth);
+  AnalQueue<AnalEvent*> read_q(mPipelineDepth + 1);
+  AnalQueue<AnalEvent*> derived_q(mPipelineDepth + 1);
+
+  for (auto &ev : events) free_q.Push(&ev);
+
+  std::thread reader ([&]() { ReadStage(free_q, read_q); });
+  std::thread derive ([&]() { DeriveStage(read_q, derived_q); });
+
+  const Long64_t n_done_before = mNDone;
+  Long64_t       n_done        = 0;
+
+  mIoLoaded = true;
+
+  while (AnalEvent *ev = derived_q.Pop())
+  {
+    SwapEvent(*ev);
+
+    if (mTreeNumber != ev->f_tree_number)
+    {
+      SetEntryListTrees(ev->f_tree_number);
+    }
+
+    if (mChnI % NDiv == 0)
+    {
+      ReportProgress(n_done_before + n_done);
+    }
+
+    ProcessLoadedEntry();
+
+    free_q.Push(ev);
+    ++n_done;
+  }
+
+  reader.join();
+  derive.join();
+
+  mNDone        = n_done_before + n_done;
+  mReadWaits    = free_q.GetEmptyWaits();
+  mExtractWaits = derived_q.GetEmptyWaits();
+}
+
+//------------------------------------------------------------------------------
+
+void AnalManager::ProcessRanges(const vRange_t& ranges_in)
+{
+  vRange_t ranges = ranges_in;
+
+  mNAssigned = 0;
+  for (auto &r : ranges) mNAssigned += r.second - r.first;
+
+  if (sResume)
+  {
+    // Drop entries processed before the checkpoint, in order of ranges.
+    Long64_t n_skip = mNDone = ReadCheckpoint();
+    while ( ! ranges.empty() && n_skip > 0)
+    {
+      Long64_t n = TMath::Min(n_skip, ranges.front().second - ranges.front().first);
+      ranges.front().first += n;
+      n_skip               -= n;
+      if (ranges.front().first == ranges.front().second) ranges.erase(ranges.begin());
+    }
+  }
+
+  mLastCheckpoint = std::chrono::steady_clock::now();
+  mLastSnapshot   = mLastCheckpoint;
+  mNextSnapN      = mNDone + mSnapEvery;
+
+  if (mPrefetchNextFile)
+  {
+    mPrefetcher = new AnalPrefetcher;
+    mPrefetcher->Start();
+  }
+
+  for (auto ext : mAnalExs)
+    if (ext->IsSkimming()) ext->OpenSkim();
+
+  if (mExtractorThreads > 0 && mAnalExs.size() > 1)
+  {
+    ROOT::EnableThreadSafety();
+    mFanOut = new AnalFanOut(mExtractorThreads, [this](Int_t i) { RunExtractor(mFanExs[i]); });
+  }
+
+  mRangesToDo = ranges;
+  mRangeI     = 0;
+
+  if (mPipelineDepth > 0)
+  {
+    ProcessPipelined();
+  }
+  else
+  {
+    std::pair<Long64_t, Long64_t> r;
+    while (NextRange(r))
+    {
+      if (mShuffle) mUnitPassBefore = PassCounts();
+      ProcessRange(r.first, r.second);
+      if (mShuffle) EndUnit(r.second - r.first);
+    }
+
+    CollectCacheStats();
+  }
+
+  delete mFanOut;
+  mFanOut = 0;
+
+  // Final position, so a finished worker is not redone when another one
+  // or the merge fails. Removed by Process() after a successful run.
+  if (mCheckpointInterval > 0) WriteCheckpoint(mNDone);
+
+  if (IsWorker() && ! mMaster->mMetricsFile.IsNull()) PublishCounts();
+
+  for (auto ext : mAnalExs)
+    if (ext->IsSkimming()) ext->CloseSkim();
+
+  if (mPrefetcher)
+  {
+    mPrefetcher->Stop();
+    if ( ! IsWorker())
+      printf("Prefetched %d files, %.1f MB.\n", mPrefetcher->GetFilesDone(), mPrefetcher->GetBytesRead() / 1048576.0);
+    delete mPrefetcher;
+    mPrefetcher = 0;
+  }
+}
+
+void AnalManager::ProcessParallel(const vRange_t& ranges)
+{
+  // Cut the entries into cluster-aligned units, so that no two workers
+  // decompress the same baskets, and hand them out through a work-stealing
+  // queue. Each worker replica starts on a consecutive block. Pass counts
+  // and histograms of the replicas are then added into the master filters
+  // / extractors.
+
+  ROOT::EnableThreadSafety();
+
+  std::vector<AnalManager*> workers;
+  std::vector<std::thread>  threads;
+  std::atomic<Int_t>        n_finished(0);
+
+  Long64_t n_total = 0;
+  for (auto &r : ranges) n_total += r.second - r.first;
+
+  // About 16 units per worker for balancing, fewer when clusters are big.
+  vRange_t units = WorkUnits(ranges, TMath::Max(1ll, n_total / (16 * mNThreads)));
+  if (mShuffle) ShuffleUnits(units);
+  mNUnits = units.size();
+
+  AnalWorkQueue wq(units, mNThreads);
+
+  // Checkpoints need the same assignment in every run, no stealing then.
+  const bool steal = mCheckpointInterval <= 0 && ! sResume;
+
+  printf("AnalManager::ProcessParallel %zu work units%s.\n", units.size(),
+         steal ? ", work stealing" : ", fixed blocks");
+
+  std::vector<vRange_t> parts(mNThreads);
+
+  for (Int_t i = 0; i < mNThreads; ++i)
+  {
+    AnalManager *w = new AnalManager(*this, i);
+    if (steal)
+      w->mWorkQueue = &wq;
+    else
+      parts[i] = wq.GetBlock(i);
+    w->SetupBranchStatus();
+    if (mStoreEntryLists) w->CreateEntryLists();
+    for (auto ext : w->mAnalExs) ext->BookHistos();
+    workers.push_back(w);
+  }
+
+  for (Int_t i = 0; i < mNThreads; ++i)
+  {
+    AnalManager    *w = workers[i];
+    const vRange_t &r = parts[i];
+    threads.emplace_back([w, &r, &n_finished]()
+    {
+      w->ProcessRanges(r);
+      ++n_finished;
+    });
+  }
+
+  while (n_finished < mNThreads)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    Long64_t n_done = 0;
+    for (auto w : workers) n_done += w->mNDone;
+
+    if (mOnTty)
+    {
+      printf("\x1b[2K\x1b[31mProgress: %5.2f%% (%d threads)\x1b[0m\x1b[0E",
+             100*(double)n_done/n_total, mNThreads);
+      fflush(stdout);
+    }
+
+    if (MetricsDue())
+    {
+      WriteMetrics(n_done, TFile::GetFileBytesRead(), workers);
+    }
+  }
+
+  for (auto &t : threads) t.join();
+
+  for (auto w : workers)
+  {
+    AddCounts(*w);
+
+    mReadTime.Add(w->mReadTime);
+    mDeriveTime.Add(w->mDeriveTime);
+    mReadWaits    += w->mReadWaits;
+    mExtractWaits += w->mExtractWaits;
+    mNBytes       += w->mNBytes;
+    mNRead        += w->mNRead;
+    mCacheHits    += w->mCacheHits;
+    mCacheNRead   += w->mCacheNRead;
+    mResumedWall   = TMath::Max(mResumedWall, w->mResumedWall);
+
+    for (auto &fp : w->mReplicaMap)
+    {
+      fp.first->AddCounts(*fp.second);
+    }
+
+    for (auto &mc : w->mFiMaskCounts)
+    {
+      mFiMaskCounts[mc.first] += mc.second;
+    }
+
+    // Entries of a key can be spread over workers.
+    for (auto &kv : w->mSampleKeyPass)
+    {
+      std::vector<Long64_t> &v = mSampleKeyPass[kv.first];
+      v.resize(kv.second.size());
+      for (size_t i = 0; i < v.size(); ++i) v[i] += kv.second[i];
+    }
+
+    for (size_t i = 0; i < mAnalExs.size(); ++i)
+    {
+      mAnalExs[i]->AddCounts(*w->mAnalExs[i]);
+      mAnalExs[i]->mProcessTime.Add(w->mAnalExs[i]->mProcessTime);
+      mAnalExs[i]->Merge(w->mAnalExs[i]);
+    }
+
+    delete w;
+  }
+
+  mCacheHitRate = mCacheNRead > 0 ? mCacheHits / mCacheNRead : 0;
+
+  if (steal)
+    printf("AnalManager::ProcessParallel %d work units were stolen.\n", wq.GetNStolen());
+}
+
+void AnalManager::ProcessStream()
+{
+  // Records are decoded straight into F, U, S and I, mChnI counts them.
+  // Snapshots are checked after each record, so an idle stream does not
+  // write any, there is nothing new to flush.
+
+  AnalStream stream(mStreamSource, mStreamIdle);
+  if ( ! stream.Open())
+  {
+    fprintf(stderr, "AnalManager::ProcessStream can not open '%s'. Dying ...\n", mStreamSource.Data());
+    exit(1);
+  }
+
+  mLastSnapshot = std::chrono::steady_clock::now();
+  mNextSnapN    = mSnapEvery;
+
+  for (auto ext : mAnalExs)
+    if (ext->IsSkimming()) ext->OpenSkim();
+
+  mDeferIo = false;
+
+  for (mChnI = 0; stream.Next(); ++mChnI)
+  {
+    {
+      AnalStageTimer _t(mReadTime);
+      stream.Decode(F, U, S, I);
+    }
+    mIoLoaded = true;
+    ++mNRead;
+
+    ProcessLoadedEntry();
+
+    mNDone = mChnI + 1;
+
+    if (SnapshotDue(mNDone))
+    {
+      WriteSnapshot(mNDone);
+    }
+
+    if (MetricsDue())
+    {
+      WriteMetrics(mNDone, stream.GetNBytes(), {});
+    }
+
+    if (mOnTty && mNDone % 10000 == 0)
+    {
+      printf("\x1b[2K\x1b[31mStream: %lld records\x1b[0m\x1b[0E", (Long64_t) mNDone);
+      fflush(stdout);
+    }
+  }
+
+  for (auto ext : mAnalExs)
+    if (ext->IsSkimming()) ext->CloseSkim();
+
+  mNBytes = stream.GetNBytes();
+  mNTotal = mNDone;
+
+  printf("%sAnalManager::ProcessStream %lld records, %.1f MB.\n", mOnTty ? "\n" : "",
+         stream.GetNRecords(), stream.GetNBytes() / 1048576.0);
+}
+
+std::vector<Long64_t> AnalManager::ClusterStarts(const vRange_t& ranges)
+{
+  // Uses the master chain before workers are started.
+
+  std::vector<Long64_t> starts;
+
+  const Int_t     n_files = mChn->GetNtrees();
+  const Long64_t *offsets = mChn->GetTreeOffset();
+
+  size_t ri = 0;
+  for (Int_t f = 0; f < n_files && ri < ranges.size(); ++f)
+  {
+    const Long64_t fb = offsets[f];
+    const Long64_t fe = f + 1 < n_files ? offsets[f + 1] : mChnN;
+
+    while (ri < ranges.size() && ranges[ri].second <= fb) ++ri;
+    if (ri == ranges.size() || ranges[ri].first >= fe) continue;
+
+    mChn->LoadTree(fb);
+    TTree::TClusterIterator ci = mChn->GetTree()->GetClusterIterator(0);
+    Long64_t s;
+    while ((s = ci()) < fe - fb)
+    {
+      starts.push_back(fb + s);
+    }
+  }
+  starts.push_back(mChnN);
+
+  return starts;
+}
+
+vRange_t AnalManager::WorkUnits(const vRange_t& ranges, Long64_t min_size)
+{
+  // Units do not span files, a worker does not have to open a file for a
+  // few entries.
+
+  std::vector<Long64_t> starts = ClusterStarts(ranges);
+
+  const Int_t     n_files = mChn->GetNtrees();
+  const Long64_t *offsets = mChn->GetTreeOffset();
+
+  vRange_t units;
+  size_t   k = 0;
+  for (auto &r : ranges)
+  {
+    Long64_t b = r.first;
+    while (b < r.second)
+    {
+      while (starts[k + 1] <= b) ++k;
+
+      const Int_t    fi       = std::upper_bound(offsets, offsets + n_files, b) - offsets;
+      const Long64_t file_end = fi < n_files ? offsets[fi] : mChnN;
+
+      Long64_t e = starts[k + 1];
+      while (e - b < min_size && e < file_end && e < r.second)
+      {
+        ++k;
+        e = starts[k + 1];
+      }
+      e = TMath::Min(e, r.second);
+
+      units.push_back(std::make_pair(b, e));
+      b = e;
+    }
+  }
+
+  return units;
+}
+
+//------------------------------------------------------------------------------
+
+vRange_t AnalManager::PrepareRanges()
+{
+  mChnN = mChn->GetEntries();
+
+  SetupBranchStatus();
+
+  vRange_t ranges;
+  if (mHasEntryRanges)
+    ranges = mEntryRanges;
+  else
+    ranges.push_back(std::make_pair(0ll, mChnN));
+
+  if (sNShards > 1)          ApplyShard(ranges);
+
+  if ( ! mInElName.IsNull()) ApplyInputEntryList(ranges);
+
+  if (mStoreEntryLists) CreateEntryLists();
+
+  Long64_t n_total = 0;
+  for (auto &r : ranges) n_total += r.second - r.first;
+  mNTotal = n_total;
+
+  printf("AnalManager::Process(), going over %lld entries", n_total);
+  if (n_total != mChnN) printf(" of %lld in chain", mChnN);
+  printf(" ...\n");
+
+  if (mNThreads > 1 && mImtThreads >= 0)
+  {
+    printf("AnalManager::Process implicit MT is ignored with worker threads.\n");
+    mImtThreads = -1;
+  }
+
+  if (mShuffle && mNThreads <= 1)
+  {
+    ranges = WorkUnits(ranges, TMath::Max(1ll, n_total / 1024));
+    ShuffleUnits(ranges);
+    mNUnits = ranges.size();
+    printf("AnalManager::Process %zu work units in shuffled order.\n", ranges.size());
+  }
+
+  return ranges;
+}
+
+void AnalManager::Process()
+{
+  for (auto ext : mAnalExs) ext->BookHistos();
+
+  // Entry lists of lazily evaluated filters would depend on their order.
+  if (mStoreEntryLists && ! mExactFilterCounts)
+  {
+    printf("AnalManager::Process entry lists are stored, filter counts are made exact.\n");
+    mExactFilterCounts = true;
+  }
+
+  vRange_t ranges;
+  if (IsStreaming())
+  {
+    if (mNThreads > 1 || mPipelineDepth > 0 || mImtThreads >= 0 || mCheckpointInterval > 0 ||
+        mShuffle || mStoreEntryLists || ! mInElName.IsNull())
+    {
+      printf("AnalManager::Process threads, pipeline, implicit MT, checkpoints, shuffle\n"
+             "  and entry lists are ignored for streamed input.\n");
+      mNThreads = 1; mPipelineDepth = 0; mImtThreads = -1; mCheckpointInterval = 0;
+      mShuffle  = false; mStoreEntryLists = false; mInElName = "";
+    }
+  }
+  else
+  {
+    ranges = PrepareRanges();
+  }
+
+  if (mSnapInterval > 0 || mSnapEvery > 0)
+  {
+    gSystem->mkdir(mOutDirName + "/snapshots");
+    ROOT::EnableThreadSafety();
+    mSnapWriter = new AnalSnapshotWriter;
+    mSnapWriter->Start();
+  }
+
+  mLoopStart        = std::chrono::steady_clock::now();
+  mLastMetrics      = mLoopStart;
+  mMetricsPrevN     = 0;
+  mMetricsPrevBytes = IsStreaming() ? 0 : TFile::GetFileBytesRead();
+
+  if (IsStreaming())
+    ProcessStream();
+  else if (mNThreads > 1)
+    ProcessParallel(ranges);
+  else
+    ProcessRanges(ranges);
+
+  if (mSnapWriter)
+  {
+    mSnapWriter->Stop();
+    printf("%s%d snapshots written.\n", mOnTty ? "\n" : "", mSnapWriter->GetNWritten());
+    delete mSnapWriter;
+    mSnapWriter = 0;
+  }
+
+  mProcessWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - mLoopStart).count() +
+                 mResumedWall;
+
+  if ( ! mMetricsFile.IsNull())
+  {
+    WriteMetrics(mNTotal, IsStreaming() ? mNBytes : TFile::GetFileBytesRead(), {}, true);
+  }
+
+  printf("%sDone!\n\n", mOnTty ? "\n" : "");
+
+  if (IsSampling())
+  {
+    for (auto ext : mAnalExs) ext->ScaleForSampling(mSampleFraction);
+  }
+
+  for (auto ext : mAnalExs) ext->WriteHistos();
+
+  if (mStoreEntryLists) WriteEntryLists();
+
+  WriteCounts();
+
+  WriteManifest();
+
+  if ( ! mPrevOutDir.IsNull())
+  {
+    AnalMerger merger(mOutDirName, mNThreads);
+    merger.MergePrevious(mPrevOutDir);
+  }
+
+  // Results are complete, checkpoints are no longer needed.
+  if (mCheckpointInterval > 0 || sResume)
+  {
+    gSystem->Unlink(CheckpointName());
+    for (Int_t i = 0; i < mNThreads; ++i)
+      gSystem->Unlink(TString::Format("%s/checkpoint-w%d.root", mOutDirName.Data(), i));
+  }
+
+  // Print pass counts and time spent in all extractors and filters.
+  // Extractor times are for Process(), filter times for Filter() plus
+  // I. reads done for it, those are also in the GetEntry row.
+  printf("\n");
+  printf("%-34s   %12s  %12s  %10s  %10s\n", "", "pass count", "evaluated", "wall [s]", "cpu [s]");
+  printf("Manager pass count                 = %'12lld  %'12lld  %10.2f  %10.2f\n", GetPassCount(),
+         GetTotalCount(), mFilterTime.f_wall, mFilterTime.f_cpu);
+  for (auto ext : mAnalExs)
+    printf("Extractor %-24s = %'12lld  %'12lld  %10.2f  %10.2f\n", ext->RefName().Data(), ext->GetPassCount(),
+           ext->GetTotalCount(), ext->RefProcessTime().f_wall, ext->RefProcessTime().f_cpu);
+
+  for (auto fil : OrderedFilters())
+    printf("Filter    %-24s = %'12lld  %'12lld  %10.2f  %10.2f\n", fil->RefName().Data(), fil->GetPassCount(),
+           fil->GetTotalCount(), fil->RefFilterTime().f_wall, fil->RefFilterTime().f_cpu);
+  if ( ! mExactFilterCounts && ! mAnalFis.empty())
+    printf("Filter counts are over entries where the filter was needed. Runs with another number of\n"
+           "threads can differ, SetExactFilterCounts(true) gives counts that do not.\n");
+
+  printf("GetEntry                           = %'12lld  %12s  %10.2f  %10.2f\n", mNRead, "",
+         mReadTime.f_wall, mReadTime.f_cpu);
+  if (IsSampling())
+    PrintSampleEstimates();
+  if (mPipelineDepth > 0)
+    printf("Derive (pipeline)                  = %12s  %12s  %10.2f  %10.2f\n", "", "",
+           mDeriveTime.f_wall, mDeriveTime.f_cpu);
+  if (mNThreads > 1)
+    printf("Times are sums over %d threads.\n", mNThreads);
+
+  PrintCutFlow();
+
+  PrintReadStats();
+
+  WriteRunReport();
+}
+
+//==============================================================================
+
+void AnalManager::CreateEntryLists()
+{
+  CreateEntryList();
+  for (auto f : mAnalFis) f->CreateEntryList();
+  for (auto e : mAnalExs) e->CreateEntryList();
+}
+
+void AnalManager::WriteEntryLists()
+{
+  TString fname = mOutDirName + "/entry_lists.root";
+
+  TFile f(fname, "recreate");
+  if (f.IsZombie())
+  {
+    fprintf(stderr, "AnalManager::WriteEntryLists can not open '%s'.\n", fname.Data());
+    return;
+  }
+
+  auto write = [](AnalFilter *flt)
+  {
+    if (flt->GetEntryList()) flt->GetEntryList()->Write(flt->RefName());
+  };
+
+  f.mkdir("Manager")->cd();
+  write(this);
+  f.mkdir("Filters")->cd();
+  for (auto flt : mAnalFis) write(flt);
+  f.mkdir("Extractors")->cd();
+  for (auto ext : mAnalExs) write(ext);
+
+  f.Close();
+
+  printf("Entry lists written to '%s'.\n", fname.Data());
+}
+
+void AnalManager::ApplyInputEntryList(vRange_t& ranges)
+{
+  // Replace ranges with the entries of the input list that are within them.
+  // Sub-lists are matched to chain files by tree and file name so the
+  // list has to come from a run over the same files with the same prefix.
+
+  TFile *f = TFile::Open(mInElFile);
+  TEntryList *el = f ? (TEntryList*) f->Get(mInElName) : 0;
+  if ( ! el)
+  {
+    fprintf(stderr, "AnalManager::ApplyInputEntryList can not get '%s' from '%s'. Dying ...\n",
+            mInElName.Data(), mInElFile.Data());
+    exit(1);
+  }
+
+  vRange_t el_ranges;
+
+  const Long64_t *offsets = mChn->GetTreeOffset();
+
+  TIter next(mChn->GetListOfFiles());
+  Int_t tree_no = 0;
+  while (TChainElement *ce = (TChainElement*) next())
+  {
+    TEntryList *sub = el->GetEntryList(mChn->GetName(), ce->GetTitle(), "ne");
+    const Long64_t n = sub ? sub->GetN() : 0;
+    for (Long64_t i = 0; i < n; ++i)
+    {
+      Long64_t e = offsets[tree_no] + sub->GetEntry(i);
+
+      if ( ! el_ranges.empty() && el_ranges.back().second == e)
+        ++el_ranges.back().second;
+      else
+        el_ranges.push_back(std::make_pair(e, e + 1));
+    }
+    ++tree_no;
+  }
+
+  const Long64_t n_el = el->GetN();
+
+  delete f;
+
+  vRange_t res = intersect_ranges(ranges, el_ranges);
+
+  printf("AnalManager::ApplyInputEntryList '%s' from '%s', %lld entries in %d ranges.\n",
+         mInElName.Data(), mInElFile.Data(), n_el, (Int_t) res.size());
+
+  ranges.swap(res);
+}
+
+void AnalManager::ApplyShard(vRange_t& ranges)
+{
+  const Int_t n_files = mChn->GetNtrees();
+
+  Long64_t beg, end;
+  if (n_files >= sNShards)
+  {
+    const Long64_t *offsets = mChn->GetTreeOffset();
+    const Int_t fb = (Long64_t)  sShardI      * n_files / sNShards;
+    const Int_t fe = (Long64_t) (sShardI + 1) * n_files / sNShards;
+    beg = offsets[fb];
+    end = fe < n_files ? offsets[fe] : mChnN;
+    printf("AnalManager::ApplyShard shard %d of %d, files %d - %d.\n",
+           sShardI, sNShards, fb, fe - 1);
+  }
+  else
+  {
+    // Cut at cluster boundaries, all shards see the same ones.
+    std::vector<Long64_t> starts = ClusterStarts(ranges);
+    auto snap = [&](Long64_t x)
+    {
+      auto i = std::lower_bound(starts.begin(), starts.end(), x);
+      if (i != starts.begin() && (i == starts.end() || *i - x > x - *(i - 1))) --i;
+      return *i;
+    };
+    beg = sShardI == 0             ? 0     : snap( sShardI      * mChnN / sNShards);
+    end = sShardI + 1 == sNShards  ? mChnN : snap((sShardI + 1) * mChnN / sNShards);
+    printf("AnalManager::ApplyShard shard %d of %d, entries %lld - %lld.\n",
+           sShardI, sNShards, beg, end - 1);
+  }
+
+  ranges = intersect_ranges(ranges, vRange_t(1, std::make_pair(beg, end)));
+}
+
+void AnalManager::WriteCounts()
+{
+  // Edge times and pass / total counts, for AnalMerger. Everything under
+  // Counts/ gets summed, the rest has to agree between shards.
+
+  TString fname = mOutDirName + "/anal_manager.root";
+
+  TFile f(fname, "recreate");
+  if (f.IsZombie())
+  {
+    fprintf(stderr, "AnalManager::WriteCounts can not open '%s'.\n", fname.Data());
+    return;
+  }
+
+  f.mkdir("Edges")->cd();
+  TParameter<Long64_t>("MinT", mMinT).Write();
+  TParameter<Long64_t>("MaxT", mMaxT).Write();
+
+  // Counts are raw, histograms already scaled.
+  f.mkdir("Sampling")->cd();
+  TParameter<Double_t>("Fraction", mSampleFraction).Write();
+
+  TDirectory *cnt = f.mkdir("Counts");
+
+  auto write = [](AnalFilter *flt)
+  {
+    TParameter<Long64_t>(flt->RefName() + "_pass",  flt->GetPassCount()) .Write();
+    TParameter<Long64_t>(flt->RefName() + "_total", flt->GetTotalCount()).Write();
+  };
+
+  cnt->mkdir("Manager")->cd();
+  write(this);
+  cnt->mkdir("Filters")->cd();
+  for (auto flt : mAnalFis) write(flt);
+  cnt->mkdir("Extractors")->cd();
+  for (auto ext : mAnalExs) write(ext);
+
+  f.Close();
+}
 
 //==============================================================================
 
-AnalManager::AnalManager(const TString& name,      const TString& out_dir,
-                         const TString& tree_name, const TString& pfx,
-                         bool setup_I_branch) :
-  AnalFilter(name, *this),
-  mChn(0), mChnN(-1), mChnI(-1),
-  mInFilePrefix(pfx),
-  mOutDirName(out_dir),
-  _fp(&F), _up(&U), _sp(&S), _ip(&I),
-  mBranchIActive(setup_I_branch),
-  mSDomainRe("[^.]+\\.[^.]+$", "o"),
-  mUDomainRe("[^.]+\\.[^.]+$", "o"),
-  mSlashRe("/", "o")
-{
-  // Make sure out-dir does not exist and then create it.
-  if (gSystem->AccessPathName(mOutDirName) == false)
+bool AnalManager::ReadManifest(const TString& dir)
+{
+  // Tab separated, file names may have spaces.
+
+  FILE *fp = fopen(dir + "/manifest.txt", "r");
+  if ( ! fp) return false;
+
+  char line[8192];
+  bool has_edges = false;
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    TString l(line);
+    l.Remove(TString::kTrailing, '\n');
+
+    std::vector<TString> f;
+    TString tok;
+    Ssiz_t  from = 0;
+    while (l.Tokenize(tok, from, "\t")) f.push_back(tok);
+
+    if (f.size() == 3 && f[0] == "edges")
+    {
+      mPrevMinT = f[1].Atoll();
+      mPrevMaxT = f[2].Atoll();
+      has_edges = true;
+    }
+    else if (f.size() == 4 && f[0] == "file")
+    {
+      mManifest[f[3]] = std::make_pair(f[1].Atoll(), f[2].Atoll());
+    }
+    else if (f.size() == 2 && f[0] == "partial")
+    {
+      fprintf(stderr, "Results in '%s' are from a partial run (%s), can not add to them. Dying ...\n",
+              dir.Data(), f[1].Data());
+      exit(1);
+    }
+  }
+
+  fclose(fp);
+
+  return has_edges;
+}
+
+void AnalManager::WriteManifest()
+{
+  // Files processed into this output directory, including previous runs.
+  // A streamed run adds its source and record count instead, nothing to
+  // skip next time. Runs over part of the files' entries do not list them
+  // but say why, ReadManifest() then refuses to continue from them.
+
+  TString fname = mOutDirName + "/manifest.txt";
+
+  FILE *fp = fopen(fname, "w");
+  if ( ! fp)
+  {
+    fprintf(stderr, "AnalManager::WriteManifest can not write '%s'.\n", fname.Data());
+    return;
+  }
+
+  TString partial;
+  auto partial_if = [&](bool r, const char *what)
+  {
+    if (r) partial += TString(partial.IsNull() ? "" : ", ") + what;
+  };
+  partial_if(sNShards > 1,            "shard");
+  partial_if(mHasEntryRanges,         "entry ranges");
+  partial_if( ! mInElName.IsNull(),   "entry list");
+  partial_if(IsSampling(),            "sampling");
+  partial_if(mWindowMin != LLONG_MIN || mWindowMax != LLONG_MAX, "time window");
+
+  auto files = mManifest;
+
+  TIter next(mChn->GetListOfFiles());
+  while (TChainElement *el = IsStreaming() || ! partial.IsNull() ? 0 : (TChainElement*) next())
+  {
+    FileStat_t st;
+    if (gSystem->GetPathInfo(el->GetTitle(), st) == 0)
+      files[el->GetTitle()] = std::make_pair((Long64_t) st.fSize, (Long64_t) st.fMtime);
+    else
+      files[el->GetTitle()] = std::make_pair(-1ll, -1ll);
+  }
+
+  fprintf(fp, "# AnalManager manifest\n");
+  fprintf(fp, "edges\t%lld\t%lld\n", mMinT, mMaxT);
+  if (IsStreaming())
+  {
+    fprintf(fp, "stream\t%lld\t%lld\t%s\n", mNTotal, mNBytes, mStreamSource.Data());
+  }
+  if ( ! partial.IsNull())
+  {
+    fprintf(fp, "partial\t%s\n", partial.Data());
+  }
+  for (auto &f : files)
+  {
+    fprintf(fp, "file\t%lld\t%lld\t%s\n", f.second.first, f.second.second, f.first.Data());
+  }
+
+  fclose(fp);
+}
+
+void AnalManager::WriteRunReport()
+{
+  // Same numbers as the printed summary, for scripts comparing runs.
+  // Times of filters and extractors are sums over threads.
+
+  TString fname = mOutDirName + "/run_report.json";
+
+  FILE *fp = fopen(fname, "w");
+  if ( ! fp)
+  {
+    fprintf(stderr, "AnalManager::WriteRunReport can not write '%s'.\n", fname.Data());
+    return;
+  }
+
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  const Double_t cpu = ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec +
+                       ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+
+  auto stage = [](const AnalStageTime& t)
+  {
+    return TString::Format("{ \"wall\": %.3f, \"cpu\": %.3f }", t.f_wall, t.f_cpu);
+  };
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"name\": %s,\n", json_str(mName).Data());
+  fprintf(fp, "  \"host\": %s,\n", json_str(gSystem->HostName()).Data());
+  fprintf(fp, "  \"time\": %lld,\n", (Long64_t) time(0));
+
+  fprintf(fp, "  \"config\": {\n");
+  fprintf(fp, "    \"threads\": %d, \"pipeline_depth\": %d, \"extractor_threads\": %d,\n",
+          mNThreads, mPipelineDepth, mExtractorThreads);
+  fprintf(fp, "    \"implicit_mt\": %s, \"cache_size\": %lld, \"sample_fraction\": %g,\n",
+          mImtOn ? "true" : "false", mCacheSize, mSampleFraction);
+  fprintf(fp, "    \"shard\": %d, \"n_shards\": %d\n", sShardI, sNShards);
+  fprintf(fp, "  },\n");
+
+  bool first = true;
+
+  // Files of the chain are not read when streaming.
+  fprintf(fp, "  \"input\": {\n");
+  if (IsStreaming())
+  {
+    fprintf(fp, "    \"stream\": %s,\n", json_str(mStreamSource).Data());
+    fprintf(fp, "    \"records\": %lld,\n", mNTotal);
+    fprintf(fp, "    \"bytes\": %lld\n", mNBytes);
+  }
+  else
+  {
+    fprintf(fp, "    \"files\": [");
+    TIter next(mChn->GetListOfFiles());
+    while (TChainElement *el = (TChainElement*) next())
+    {
+      fprintf(fp, "%s\n      %s", first ? "" : ",", json_str(el->GetTitle()).Data());
+      first = false;
+    }
+    fprintf(fp, "%s],\n", first ? "" : "\n    ");
+    fprintf(fp, "    \"entries_in_chain\": %lld,\n", mChnN);
+    fprintf(fp, "    \"entries_to_process\": %lld\n", mNTotal);
+  }
+  fprintf(fp, "  },\n");
+
+  fprintf(fp, "  \"read\": {\n");
+  fprintf(fp, "    \"entries\": %lld,\n", mNRead);
+  fprintf(fp, "    \"bytes_read\": %lld,\n", IsStreaming() ? mNBytes : TFile::GetFileBytesRead());
+  fprintf(fp, "    \"bytes_decompressed\": %lld,\n", mNBytes);
+  fprintf(fp, "    \"cache_hit_rate\": %.4f\n", mCacheHitRate);
+  fprintf(fp, "  },\n");
+
+  fprintf(fp, "  \"timing\": {\n");
+  fprintf(fp, "    \"event_loop_wall\": %.3f,\n", mProcessWall);
+  fprintf(fp, "    \"process_cpu\": %.3f,\n", cpu);
+  fprintf(fp, "    \"events_per_s\": %.1f,\n", mProcessWall > 0 ? mNRead / mProcessWall : 0);
+  fprintf(fp, "    \"decompressed_mb_per_s\": %.3f,\n", mProcessWall > 0 ? mNBytes / mProcessWall / 1048576 : 0);
+  fprintf(fp, "    \"stages\": {\n");
+  fprintf(fp, "      \"read\": %s,\n", stage(mReadTime).Data());
+  fprintf(fp, "      \"derive\": %s,\n", stage(mDeriveTime).Data());
+  fprintf(fp, "      \"manager_filter\": %s\n", stage(mFilterTime).Data());
+  fprintf(fp, "    }\n");
+  fprintf(fp, "  },\n");
+
+  // ru_maxrss is in kB on Linux.
+  fprintf(fp, "  \"memory\": { \"peak_rss\": %lld },\n", (Long64_t) ru.ru_maxrss * 1024);
+
+  if (mPipelineDepth > 0)
+    fprintf(fp, "  \"pipeline\": { \"reader_waits\": %lld, \"extract_waits\": %lld },\n",
+            mReadWaits, mExtractWaits);
+
+  fprintf(fp, "  \"manager\": { \"pass\": %lld, \"total\": %lld },\n", GetPassCount(), GetTotalCount());
+
+  fprintf(fp, "  \"filters\": [");
+  first = true;
+  for (auto fil : mAnalFis)
+  {
+    fprintf(fp, "%s\n    { \"name\": %s, \"pass\": %lld, \"total\": %lld, \"time\": %s }",
+            first ? "" : ",", json_str(fil->RefName()).Data(), fil->GetPassCount(), fil->GetTotalCount(),
+            stage(fil->RefFilterTime()).Data());
+    first = false;
+  }
+  fprintf(fp, "%s],\n", first ? "" : "\n  ");
+
+  fprintf(fp, "  \"extractors\": [");
+  first = true;
+  for (auto ext : mAnalExs)
+  {
+    fprintf(fp, "%s\n    { \"name\": %s, \"class\": %s, \"pass\": %lld, \"total\": %lld, \"time\": %s,"
+            " \"histo_bytes\": %lld }",
+            first ? "" : ",", json_str(ext->RefName()).Data(), json_str(ext->ClassTag()).Data(),
+            ext->GetPassCount(), ext->GetTotalCount(), stage(ext->RefProcessTime()).Data(),
+            ext->GetHistoBytes());
+    first = false;
+  }
+  fprintf(fp, "%s]\n", first ? "" : "\n  ");
+
+  fprintf(fp, "}\n");
+
+  fclose(fp);
+}
+
+void AnalManager::FilterProcessedFiles(std::vector<TString>& names)
+{
+  // Drop files listed in the manifest. A changed file can not be handled
+  // incrementally as its old contents are already in the results.
+
+  std::vector<TString> left;
+  for (auto &n : names)
+  {
+    auto mi = mManifest.find(n);
+    if (mi == mManifest.end())
+    {
+      left.push_back(n);
+      continue;
+    }
+
+    FileStat_t st;
+    if (mi->second.first >= 0 && gSystem->GetPathInfo(n, st) == 0 &&
+        (st.fSize != mi->second.first || st.fMtime != mi->second.second))
+    {
+      fprintf(stderr, "File '%s' changed since it was processed, do a full run. Dying ...\n",
+              n.Data());
+      exit(1);
+    }
+  }
+
+  printf("AnalManager::AddFile %d of %d files are new.\n", (Int_t) left.size(), (Int_t) names.size());
+
+  names.swap(left);
+}
+
+TString AnalManager::CheckpointName() const
+{
+  if (IsWorker())
+    return TString::Format("%s/checkpoint-w%d.root", mOutDirName.Data(), mWorkerId);
+  else
+    return mOutDirName + "/checkpoint.root";
+}
+
+vpAnalFilter_t AnalManager::OrderedFilters() const
+{
+  // First occurrence over the extractors' mFilters and mAntiFilters, the
+  // order AddExtractor() assigns bits in, so filter i has mask bit i.
+
+  vpAnalFilter_t v;
+  spAnalFilter_t seen;
+  for (auto ext : mAnalExs)
+  {
+    for (auto f : ext->mFilters)     if (seen.insert(f).second) v.push_back(f);
+    for (auto f : ext->mAntiFilters) if (seen.insert(f).second) v.push_back(f);
+  }
+  return v;
+}
+
+void AnalManager::WriteCheckpoint(Long64_t n_done)
+{
+  // Called between entries, n_done entries of the assigned ranges are
+  // fully accounted for. Written to a temporary and renamed.
+
+  auto t0 = std::chrono::steady_clock::now();
+
+  TString fname = CheckpointName();
+  TString tname = fname + ".tmp";
+
+  TFile *f = TFile::Open(tname, "recreate");
+  if ( ! f)
+  {
+    fprintf(stderr, "AnalManager::WriteCheckpoint can not open '%s'.\n", tname.Data());
+    return;
+  }
+
+  auto put = [](TDirectory *dir, const TString& name, Long64_t val)
+  {
+    TParameter<Long64_t> p(name, val);
+    dir->WriteTObject(&p);
+  };
+
+  auto put_d = [](TDirectory *dir, const TString& name, Double_t val)
+  {
+    TParameter<Double_t> p(name, val);
+    dir->WriteTObject(&p);
+  };
+  auto put_time = [&](TDirectory *dir, const TString& key, const AnalStageTime& t)
+  {
+    put_d(dir, key + "_wall", t.f_wall);
+    put_d(dir, key + "_cpu",  t.f_cpu);
+  };
+  auto put_vec = [](TDirectory *dir, const TString& name, const std::vector<Double_t>& v)
+  {
+    TVectorD tv(v.size(), v.data());
+    dir->WriteTObject(&tv, name);
+  };
+
+  const AnalManager *top = mMaster ? mMaster : this;
+
+  TDirectory *pos = f->mkdir("Position");
+  put(pos, "NDone",     n_done);
+  put(pos, "NAssigned", mNAssigned);
+  put(pos, "NThreads",  top->mNThreads);
+  put(pos, "Shuffle",   mShuffle ? (Long64_t) mShuffleSeed : -1);
+  put_d(pos, "SampleFraction", mSampleFraction);
+  put_d(pos, "Wall", std::chrono::duration<double>(std::chrono::steady_clock::now() - top->mLoopStart).count() +
+                     mResumedWall);
+
+  vpAnalFilter_t fis = OrderedFilters();
+
+  TDirectory *cnt = f->mkdir("Counts");
+  TDirectory *tms = f->mkdir("Times");
+  TDirectory *els = f->mkdir("EntryLists");
+  auto write = [&](AnalFilter *flt, const TString& key)
+  {
+    put(cnt, key + "_pass",  flt->GetPassCount());
+    put(cnt, key + "_total", flt->GetTotalCount());
+    put_time(tms, key, flt->RefFilterTime());
+    if (flt->GetEntryList()) els->WriteTObject(flt->GetEntryList(), key);
+  };
+
+  write(this, "Manager");
+  for (size_t i = 0; i < fis.size(); ++i)
+    write(fis[i], TString::Format("Filter_%d", (Int_t) i));
+  for (size_t i = 0; i < mAnalExs.size(); ++i)
+  {
+    write(mAnalExs[i], TString::Format("Extractor_%d", (Int_t) i));
+    put_time(tms, TString::Format("Extractor_%d_process", (Int_t) i), mAnalExs[i]->mProcessTime);
+  }
+
+  TDirectory *exs = f->mkdir("Extractors");
+  for (size_t i = 0; i < mAnalExs.size(); ++i)
+  {
+    mAnalExs[i]->WriteState(exs->mkdir(TString::Format("Extractor_%d", (Int_t) i)));
+  }
+
+  // What the summary, cut-flow, estimates and run report are made of, so
+  // they cover the whole run after a resume.
+  TDirectory *sts = f->mkdir("Stats");
+  put  (sts, "NRead",      mNRead);
+  put  (sts, "NBytes",     mNBytes);
+  put_d(sts, "CacheHits",  mCacheHits);
+  put  (sts, "CacheNRead", mCacheNRead);
+  put_time(sts, "Read",   mReadTime);
+  put_time(sts, "Derive", mDeriveTime);
+  put  (sts, "UnitsDone",  mUnitsDone);
+  put_d(sts, "UnitN",      mUnitN);
+  put_d(sts, "UnitN2",     mUnitN2);
+  put_vec(sts, "UnitT",    mUnitT);
+  put_vec(sts, "UnitT2",   mUnitT2);
+  put_vec(sts, "UnitTN",   mUnitTN);
+
+  // Masks and sample keys are 64 bit, kept exact in trees.
+  sts->cd();
   {
-    fprintf(stderr, "Output directory '%s' already exists. Cowardly refusing to use it :(\n",
-            mOutDirName.Data());
-    exit(1);
+    ULong64_t eval, pass;
+    Long64_t  n;
+    TTree *t = new TTree("FiMaskCounts", "");
+    t->Branch("eval", &eval, "eval/l");
+    t->Branch("pass", &pass, "pass/l");
+    t->Branch("n",    &n,    "n/L");
+    for (auto &mc : mFiMaskCounts)
+    {
+      eval = mc.first.first; pass = mc.first.second; n = mc.second;
+      t->Fill();
+    }
+    t->Write();
   }
-  if (gSystem->mkdir(mOutDirName, true) == -1)
   {
-    fprintf(stderr, "Creation of output directory '%s' failed. Dying ...\n");
-    exit(1);
+    const Int_t n_slots = 1 + mAnalExs.size() + mAnalFis.size();
+    ULong64_t key;
+    std::vector<Long64_t> cnts(n_slots);
+    TTree *t = new TTree("SampleKeyPass", "");
+    t->Branch("key",  &key, "key/l");
+    t->Branch("pass", cnts.data(), TString::Format("pass[%d]/L", n_slots));
+    for (auto &kv : mSampleKeyPass)
+    {
+      key = kv.first;
+      std::copy(kv.second.begin(), kv.second.end(), cnts.begin());
+      t->Fill();
+    }
+    t->Write();
   }
 
-  mOnTty = isatty(fileno(stdout));
+  f->Close();
+  delete f;
 
-  mChn = new TChain(tree_name);
+  if (gSystem->Rename(tname, fname) != 0)
+  {
+    fprintf(stderr, "AnalManager::WriteCheckpoint can not rename '%s'.\n", tname.Data());
+  }
 
-  // ?? Can this be done before adding of the files ?
-  mChn->SetBranchAddress("F.", &_fp);
-  mChn->SetBranchAddress("U.", &_up);
-  mChn->SetBranchAddress("S.", &_sp);
-  if (mBranchIActive)
-    mChn->SetBranchAddress("I.", &_ip);
-}
+  mLastCheckpoint = std::chrono::steady_clock::now();
 
-//------------------------------------------------------------------------------
+  if ( ! IsWorker() && ! mOnTty)
+    printf("Checkpoint at %lld entries, took %.1f s.\n", n_done,
+           std::chrono::duration<double>(mLastCheckpoint - t0).count());
+}
 
-AnalManager::~AnalManager()
+void AnalManager::WriteSnapshot(Long64_t n_done)
 {
-  // In principle should delete all prefilters, filters and extractors.
-}
+  // Called between entries. Serialized into an uncompressed in-memory
+  // file to keep the stall short, handed to mSnapWriter as bytes.
+
+  TString fname = IsWorker() ?
+    TString::Format("%s/snapshots/snapshot-w%d-%03d.root", mOutDirName.Data(), mWorkerId, mSnapI) :
+    TString::Format("%s/snapshots/snapshot-%03d.root",     mOutDirName.Data(), mSnapI);
+
+  TMemFile *f = new TMemFile(fname, "recreate", "", 0);
+
+  const Double_t frac = mNTotal > 0 ? (Double_t) n_done / mNTotal : 0;
+  const Double_t wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - mLoopStart).count() +
+                        mResumedWall;
+
+  TDirectory *pos = f->mkdir("Position");
+  TParameter<Long64_t> p_done("NDone", n_done),    p_total("NTotal", mNTotal);
+  TParameter<Double_t> p_frac("Fraction", frac),   p_wall("Wall", wall);
+  pos->WriteTObject(&p_done);
+  pos->WriteTObject(&p_total);
+  pos->WriteTObject(&p_frac);
+  pos->WriteTObject(&p_wall);
+
+  // Pass count n estimates n / f_eff: shuffled units done are a fraction
+  // frac of the entries, kept keys a fraction mSampleFraction. Errors come
+  // from what is actually randomized: whole units, see UnitVariance(), and
+  // whole keys, see SampleVariance(), treated as independent. Without
+  // unit statistics (pipelined loop, fewer than two units) shuffled runs
+  // get no error.
+  const Double_t f_eff  = mSampleFraction * (mShuffle ? frac : 1);
+  const bool     do_est = (mShuffle || IsSampling()) && f_eff > 0;
+  const bool     unit_err = mShuffle && mUnitsDone >= 2;
+  const bool     do_err = do_est && (unit_err || ! mShuffle);
+
+  TDirectory *cnt = f->mkdir("Counts");
+  TDirectory *est = do_est ? f->mkdir("Estimates") : 0;
+  size_t      c   = 0;
+  auto write = [&](AnalFilter *flt)
+  {
+    TParameter<Long64_t> pass(flt->RefName() + "_pass",  flt->GetPassCount());
+    TParameter<Long64_t> tot (flt->RefName() + "_total", flt->GetTotalCount());
+    cnt->WriteTObject(&pass);
+    cnt->WriteTObject(&tot);
+    if (est)
+    {
+      const Double_t n = flt->GetPassCount();
+      TParameter<Double_t> e(flt->RefName() + "_est", n / f_eff);
+      est->WriteTObject(&e);
+    }
+    if (est && do_err)
+    {
+      const Double_t f = mSampleFraction;
+      Double_t var = 0;
+      if (unit_err)    var += UnitVariance(c) / (f * f);
+      if (IsSampling()) var += SampleVariance(c) / (mShuffle ? frac * frac : 1);
+      TParameter<Double_t> s(flt->RefName() + "_err", TMath::Sqrt(var));
+      est->WriteTObject(&s);
+    }
+    ++c;
+  };
 
-//==============================================================================
+  write(this);
+  for (auto ext : mAnalExs) write(ext);
+  for (auto fil : OrderedFilters()) write(fil);
 
-void AnalManager::AddFile(const TString& files)
-{
-  if ( ! mAnalExs.empty())
+  TDirectory *exs = f->mkdir("Extractors");
+  for (auto ext : mAnalExs)
   {
-    fprintf(stderr, "Adding files after analyses have been registered is wrong! Dying ...\n");
-    exit(1);
+    ext->WriteState(exs->mkdir(ext->RefName()));
   }
 
-  mChn->Add(mInFilePrefix + files);
+  f->Write();
+
+  std::vector<char> buf(f->GetSize());
+  f->CopyTo(&buf[0], buf.size());
+  delete f;
+
+  mSnapWriter->Request(fname, mSnapPrev, n_done, frac, std::move(buf));
+
+  mSnapPrev     = fname;
+  mLastSnapshot = std::chrono::steady_clock::now();
+  mNextSnapN    = n_done + mSnapEvery;
+  ++mSnapI;
 }
 
-void AnalManager::AddPreFilter(AnalFilter* flt)
+bool AnalManager::SnapshotDue(Long64_t n_done) const
 {
-  mPreFilters.push_back(flt);
+  return mSnapWriter &&
+    ((mSnapInterval > 0 &&
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastSnapshot).count() > mSnapInterval) ||
+     (mSnapEvery > 0 && n_done >= mNextSnapN));
 }
 
-void AnalManager::AddExtractor(AnalExtractor* ext)
+void AnalManager::PublishCounts()
 {
-  mAnalExs.push_back(ext);
-  for (auto f : ext->mFilters)     mAnalFis.insert(f);
-  for (auto f : ext->mAntiFilters) mAnalFis.insert(f);
-}
+  std::lock_guard<std::mutex> lk(mPubMutex);
 
-//==============================================================================
+  mPubExPass.resize(mAnalExs.size());
+  for (size_t i = 0; i < mAnalExs.size(); ++i) mPubExPass[i] = mAnalExs[i]->GetPassCount();
+}
 
-void AnalManager::ScanEdgeTimes(Long64_t scan_entries)
+bool AnalManager::MetricsDue() const
 {
-  printf("AnalManager::ScanEdgeTimes entered ...\n");
+  return ! mMetricsFile.IsNull() &&
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastMetrics).count() > mMetricsInterval;
+}
 
-  Long64_t N = mChn->GetEntries();
+void AnalManager::WriteMetrics(Long64_t n_done, Long64_t n_bytes,
+                               const std::vector<AnalManager*>& workers, bool done)
+{
+  // Rates are over the interval since the previous update.
 
-  printf("Chain has %lld entries.\n", N);
+  const auto     now = std::chrono::steady_clock::now();
+  const Double_t dt  = std::chrono::duration<double>(now - mLastMetrics).count();
+  const Long64_t dn  = n_done  - mMetricsPrevN;
+  const Long64_t db  = n_bytes - mMetricsPrevBytes;
 
-  if (scan_entries > N) scan_entries = N;
+  TString tname = mMetricsFile + ".tmp";
 
-  Long64_t mo, mc, Mo, Mc;
-  Long64_t imo, imc, iMo, iMc;
+  FILE *fp = fopen(tname, "w");
+  if ( ! fp)
+  {
+    fprintf(stderr, "AnalManager::WriteMetrics can not write '%s'.\n", tname.Data());
+    mLastMetrics = now;
+    return;
+  }
 
-  mChn->GetEntry(0);
-  mo = Mo = F.mOpenTime;
-  mc = Mc = F.mCloseTime;
-  imo = imc = iMo = iMc = 0;
+  const TString mgr = TString::Format("manager=\"%s\"", prom_label(mName).Data());
 
-  for (Long64_t i = 1; i < scan_entries; ++i)
+  auto metric = [&](const char *name, const char *type, const char *help)
   {
-    mChn->GetEntry(i);
-    if (F.mOpenTime  < mo) { mo = F.mOpenTime;  imo = i; }
-    if (F.mCloseTime < mc) { mc = F.mCloseTime; imc = i; }
-  }
+    fprintf(fp, "# HELP anxrdmon_%s %s\n# TYPE anxrdmon_%s %s\n", name, help, name, type);
+  };
 
-  for (Long64_t i = N - scan_entries; i < N; ++i)
+  metric("events_processed_total", "counter", "Entries done by the event loop.");
+  fprintf(fp, "anxrdmon_events_processed_total{%s} %lld\n", mgr.Data(), n_done);
+
+  metric("events_to_process", "gauge", "Entries in the job, 0 when streaming.");
+  fprintf(fp, "anxrdmon_events_to_process{%s} %lld\n", mgr.Data(), IsStreaming() ? 0 : mNTotal);
+
+  metric("events_per_second", "gauge", "Entries per second since the previous update.");
+  fprintf(fp, "anxrdmon_events_per_second{%s} %.1f\n", mgr.Data(), dt > 0 ? dn / dt : 0);
+
+  metric("read_bytes_total", "counter", "Bytes read from input files or stream.");
+  fprintf(fp, "anxrdmon_read_bytes_total{%s} %lld\n", mgr.Data(), n_bytes);
+
+  metric("read_megabytes_per_second", "gauge", "MB per second read since the previous update.");
+  fprintf(fp, "anxrdmon_read_megabytes_per_second{%s} %.3f\n", mgr.Data(), dt > 0 ? db / dt / 1048576 : 0);
+
+  metric("current_file_info", "gauge", "File being processed, per worker thread.");
+  auto file = [&](const AnalManager *m, Int_t wid)
   {
-    mChn->GetEntry(i);
-    if (F.mOpenTime  > Mo) { Mo = F.mOpenTime;  iMo = i; }
-    if (F.mCloseTime > Mc) { Mc = F.mCloseTime; iMc = i; }
+    TString name;
+    if (IsStreaming())
+    {
+      name = mStreamSource;
+    }
+    else
+    {
+      const Int_t tn = m->mTreeNumber;
+      if (tn < 0) return;
+      name = ((TChainElement*) mChn->GetListOfFiles()->At(tn))->GetTitle();
+    }
+    fprintf(fp, "anxrdmon_current_file_info{%s,worker=\"%d\",file=\"%s\"} 1\n",
+            mgr.Data(), wid, prom_label(name).Data());
+  };
+  if (workers.empty())
+    file(this, 0);
+  else
+    for (auto w : workers) file(w, w->mWorkerId);
+
+  metric("extractor_pass_total", "counter", "Entries passed to an extractor.");
+  for (size_t i = 0; i < mAnalExs.size(); ++i)
+  {
+    Long64_t n = mAnalExs[i]->GetPassCount();
+    for (auto w : workers)
+    {
+      std::lock_guard<std::mutex> lk(w->mPubMutex);
+      if (i < w->mPubExPass.size()) n += w->mPubExPass[i];
+    }
+    fprintf(fp, "anxrdmon_extractor_pass_total{%s,extractor=\"%s\"} %lld\n",
+            mgr.Data(), prom_label(mAnalExs[i]->RefName()).Data(), n);
   }
 
-  printf("Min time open %lld (%lld), close %lld (%lld)\n", mo, imo, mc, imc);
-  printf("Max time open %lld (%lld), close %lld (%lld)\n", Mo, iMo, Mc, iMc);
+  ProcInfo_t pi;
+  gSystem->GetProcInfo(&pi);
+  metric("resident_memory_bytes", "gauge", "Resident memory of the process.");
+  fprintf(fp, "anxrdmon_resident_memory_bytes{%s} %lld\n", mgr.Data(), (Long64_t) pi.fMemResident * 1024);
 
-  SetEdgeTimes(TMath::Min(mo, mc), TMath::Max(Mo, Mc), true);
+  metric("done", "gauge", "1 when the event loop has finished.");
+  fprintf(fp, "anxrdmon_done{%s} %d\n", mgr.Data(), done ? 1 : 0);
 
-  printf("  // mgr.SetEdgeTimes(%lld, %lld);\n", mMinT, mMaxT);
+  metric("last_update_timestamp_seconds", "gauge", "Time of this update.");
+  fprintf(fp, "anxrdmon_last_update_timestamp_seconds{%s} %lld\n", mgr.Data(), (Long64_t) time(0));
 
-  printf("AnalManager::ScanEdgeTimes finished.\n");
+  fclose(fp);
+
+  if (gSystem->Rename(tname, mMetricsFile) != 0)
+  {
+    fprintf(stderr, "AnalManager::WriteMetrics can not rename '%s'.\n", tname.Data());
+  }
+
+  mLastMetrics      = now;
+  mMetricsPrevN     = n_done;
+  mMetricsPrevBytes = n_bytes;
 }
 
-void AnalManager::SetEdgeTimes(Long64_t min, Long64_t max, bool verbose)
+std::vector<Long64_t> AnalManager::PassCounts() const
 {
-  printf("Time Min %lld -- %lld Max\n", min, max);
+  // Filters by bit, mAnalFis is in pointer order that differs in replicas.
+
+  std::vector<Long64_t> v(1 + mAnalExs.size() + mAnalFis.size());
+  size_t c = 0;
+  v[c++] = GetPassCount();
+  for (auto ext : mAnalExs) v[c++] = ext->GetPassCount();
+  for (auto fil : mAnalFis) v[c + fil->GetBit()] = fil->GetPassCount();
+  return v;
+}
 
-  // round to nearest hour
-  mMinT = min - min % 3600;
-  mMaxT = max + (3600 - max % 3600);
+void AnalManager::EndUnit(Long64_t n)
+{
+  // mUnitPassBefore was taken when the unit of n entries started.
 
-  printf("  Rounded Min %lld -- %lld Max\n", mMinT, mMaxT);
+  std::vector<Long64_t> now = PassCounts();
 
-  mTotalDtSec  = mMaxT - mMinT;
-  mTotalDtMin  = mTotalDtSec  / 60;
-  mTotalDtHour = mTotalDtMin  / 60;
-  mTotalDtDay  = mTotalDtHour / 24.0;
-  mTotalDtWeek = mTotalDtDay  / 7;
-  mTotalDtMonth= mTotalDtDay  / 30.4375; // = 365.25 / 12
+  mUnitT .resize(now.size());
+  mUnitT2.resize(now.size());
+  mUnitTN.resize(now.size());
+  for (size_t c = 0; c < now.size(); ++c)
+  {
+    const Double_t t = now[c] - mUnitPassBefore[c];
+    mUnitT [c] += t;
+    mUnitT2[c] += t * t;
+    mUnitTN[c] += t * n;
+  }
+  mUnitN  += n;
+  mUnitN2 += (Double_t) n * n;
+  ++mUnitsDone;
+}
 
-  TDatime dt;
-  dt.Set(mMinT);
-  mMinDate.Form("%d-%02d-%02d %02d:%02d PST",
-                dt.GetYear(), dt.GetMonth(), dt.GetDay(), dt.GetHour(), dt.GetMinute());
-  dt.Set(mMaxT);
-  mMaxDate.Form("%d-%02d-%02d %02d:%02d PST",
-                dt.GetYear(), dt.GetMonth(), dt.GetDay(), dt.GetHour(), dt.GetMinute());
+Double_t AnalManager::UnitVariance(size_t c) const
+{
+  // m of M units drawn without replacement, estimate R * N_total with
+  // R = sum T / sum N. Residuals e_u = T_u - R N_u give
+  // Var = M^2 (1 - m / M) / m * sum e_u^2 / (m - 1).
 
-  printf("  Duration = %lld s, %lld min, %lld hours,\n"
-         "             %.2f days, %.2f weeks, %.2f months\n"
-         "  From %s to %s\n",
-         mTotalDtSec, mTotalDtMin,  mTotalDtHour,
-         mTotalDtDay, mTotalDtWeek, mTotalDtMonth,
-         mMinDate.Data(), mMaxDate.Data());
+  const Double_t m = mUnitsDone, M = TMath::Max(mNUnits, mUnitsDone);
+  if (m < 2 || mUnitN <= 0) return 0;
+
+  const Double_t R  = mUnitT[c] / mUnitN;
+  const Double_t e2 = mUnitT2[c] - 2 * R * mUnitTN[c] + R * R * mUnitN2;
+
+  return M * M * (1 - m / M) / m * TMath::Max(0.0, e2) / (m - 1);
 }
 
-//==============================================================================
+void AnalManager::ShuffleUnits(vRange_t& units) const
+{
+  std::mt19937_64 rng(mShuffleSeed);
+  std::shuffle(units.begin(), units.end(), rng);
+}
 
-bool AnalManager::Filter()
+Long64_t AnalManager::ReadCheckpoint()
 {
-  // Extract commonly used data & filter out crap
+  // Restores counts, entry lists and extractor state, returns the number
+  // of entries of assigned ranges already processed.
 
-  mDt = TMath::Max(1ll, F.mCloseTime - F.mOpenTime);
+  TString fname = CheckpointName();
 
-  // Pathological time open / close / duration.
-  if (F.mCloseTime < mMinT || F.mOpenTime < mMinT || mDt > 1e6)
+  // No checkpoint yet when the run stopped before the first interval.
+  if (gSystem->AccessPathName(fname))
   {
-    printf("YEBO Event=%lld CloseTime=%lld OpenTime=%lld delta_t=%f ... skipping.\n",
-           mChnI, F.mCloseTime, F.mOpenTime, mDt);
-    return false;
+    printf("AnalManager::ReadCheckpoint no '%s', starting %s from the beginning.\n",
+           gSystem->BaseName(fname), IsWorker() ? "worker" : "run");
+    return 0;
+  }
+
+  TFile *f = TFile::Open(fname);
+  if ( ! f)
+  {
+    fprintf(stderr, "AnalManager::ReadCheckpoint can not open '%s'. Dying ...\n", fname.Data());
+    exit(1);
   }
 
-  mSDomain = (mSDomainRe.Match(S.mDomain))     ? mSDomainRe[0] : "";
-  mUDomain = (mUDomainRe.Match(U.mFromDomain)) ? mUDomainRe[0] : "";
+  auto get = [&](const TString& name) -> Long64_t
+  {
+    TParameter<Long64_t> *p = (TParameter<Long64_t>*) f->Get(name);
+    if ( ! p)
+    {
+      fprintf(stderr, "AnalManager::ReadCheckpoint '%s' missing in '%s'. Dying ...\n",
+              name.Data(), fname.Data());
+      exit(1);
+    }
+    Long64_t val = p->GetVal();
+    delete p;
+    return val;
+  };
 
-  mSlashRe.Split(F.mName);
+  auto get_d = [&](const TString& name) -> Double_t
+  {
+    TParameter<Double_t> *p = (TParameter<Double_t>*) f->Get(name);
+    if ( ! p)
+    {
+      fprintf(stderr, "AnalManager::ReadCheckpoint '%s' missing in '%s'. Dying ...\n",
+              name.Data(), fname.Data());
+      exit(1);
+    }
+    Double_t val = p->GetVal();
+    delete p;
+    return val;
+  };
+  auto get_time = [&](const TString& key)
+  {
+    AnalStageTime t;
+    t.f_wall = get_d(key + "_wall");
+    t.f_cpu  = get_d(key + "_cpu");
+    return t;
+  };
+  auto get_vec = [&](const TString& name, std::vector<Double_t>& v)
+  {
+    TVectorD *tv = (TVectorD*) f->Get(name);
+    v.clear();
+    if (tv) v.assign(tv->GetMatrixArray(), tv->GetMatrixArray() + tv->GetNrows());
+    delete tv;
+  };
+
+  const Long64_t n_done = get("Position/NDone");
+  const Double_t frac   = get_d("Position/SampleFraction");
+
+  if (get("Position/NAssigned") != mNAssigned ||
+      get("Position/NThreads")  != (mMaster ? mMaster->mNThreads : mNThreads) ||
+      get("Position/Shuffle")   != (mShuffle ? (Long64_t) mShuffleSeed : -1) ||
+      frac != mSampleFraction)
+  {
+    fprintf(stderr, "AnalManager::ReadCheckpoint '%s' is from a different setup. Dying ...\n",
+            fname.Data());
+    exit(1);
+  }
 
-  for (auto flt : mPreFilters)
+  for (auto ext : mAnalExs)
   {
-    if ( ! flt->Filter())  return false;
+    if (ext->IsSkimming())
+    {
+      fprintf(stderr, "AnalManager::ReadCheckpoint skims can not be resumed. Dying ...\n");
+      exit(1);
+    }
   }
 
-  return true;
+  vpAnalFilter_t fis = OrderedFilters();
+
+  auto read = [&](AnalFilter *flt, const TString& key)
+  {
+    flt->SetCounts(get("Counts/" + key + "_pass"), get("Counts/" + key + "_total"),
+                   get_time("Times/" + key));
+    if (flt->GetEntryList())
+    {
+      TEntryList *el = (TEntryList*) f->Get("EntryLists/" + key);
+      if (el)
+      {
+        el->SetDirectory(0);
+        flt->SetEntryList(el);
+      }
+    }
+  };
+
+  read(this, "Manager");
+  for (size_t i = 0; i < fis.size(); ++i)
+    read(fis[i], TString::Format("Filter_%d", (Int_t) i));
+  for (size_t i = 0; i < mAnalExs.size(); ++i)
+  {
+    read(mAnalExs[i], TString::Format("Extractor_%d", (Int_t) i));
+    mAnalExs[i]->mProcessTime = get_time(TString::Format("Times/Extractor_%d_process", (Int_t) i));
+  }
+
+  mResumedWall = get_d("Position/Wall");
+  mNRead       = get("Stats/NRead");
+  mNBytes      = get("Stats/NBytes");
+  mCacheHits   = get_d("Stats/CacheHits");
+  mCacheNRead  = get("Stats/CacheNRead");
+  mReadTime    = get_time("Stats/Read");
+  mDeriveTime  = get_time("Stats/Derive");
+  mUnitsDone   = get("Stats/UnitsDone");
+  mUnitN       = get_d("Stats/UnitN");
+  mUnitN2      = get_d("Stats/UnitN2");
+  get_vec("Stats/UnitT",  mUnitT);
+  get_vec("Stats/UnitT2", mUnitT2);
+  get_vec("Stats/UnitTN", mUnitTN);
+
+  // Implicit MT calibration starts over.
+  mImtStartAt = mNRead;
+
+  TTree *t_masks = (TTree*) f->Get("Stats/FiMaskCounts");
+  TTree *t_keys  = (TTree*) f->Get("Stats/SampleKeyPass");
+  if ( ! t_masks || ! t_keys)
+  {
+    fprintf(stderr, "AnalManager::ReadCheckpoint no filter mask or sample key counts in '%s'. Dying ...\n",
+            fname.Data());
+    exit(1);
+  }
+  {
+    ULong64_t eval, pass;
+    Long64_t  n;
+    t_masks->SetBranchAddress("eval", &eval);
+    t_masks->SetBranchAddress("pass", &pass);
+    t_masks->SetBranchAddress("n",    &n);
+    mFiMaskCounts.clear();
+    for (Long64_t i = 0; i < t_masks->GetEntries(); ++i)
+    {
+      t_masks->GetEntry(i);
+      mFiMaskCounts[std::make_pair(eval, pass)] = n;
+    }
+  }
+  {
+    ULong64_t key;
+    std::vector<Long64_t> cnts(1 + mAnalExs.size() + mAnalFis.size());
+    t_keys->SetBranchAddress("key",  &key);
+    t_keys->SetBranchAddress("pass", cnts.data());
+    mSampleKeyPass.clear();
+    for (Long64_t i = 0; i < t_keys->GetEntries(); ++i)
+    {
+      t_keys->GetEntry(i);
+      mSampleKeyPass[key] = cnts;
+    }
+  }
+  delete t_masks;
+  delete t_keys;
+
+  for (size_t i = 0; i < mAnalExs.size(); ++i)
+  {
+    TDirectory *d = f->GetDirectory(TString::Format("Extractors/Extractor_%d", (Int_t) i));
+    if ( ! d)
+    {
+      fprintf(stderr, "AnalManager::ReadCheckpoint no state for '%s'. Dying ...\n",
+              mAnalExs[i]->RefName().Data());
+      exit(1);
+    }
+    mAnalExs[i]->ReadState(d);
+  }
+
+  f->Close();
+  delete f;
+
+  if ( ! IsWorker())
+    printf("AnalManager::ReadCheckpoint resuming after %lld of %lld entries.\n", n_done, mNAssigned);
+
+  return n_done;
 }
 
-//==============================================================================
+//------------------------------------------------------------------------------
 
-void AnalManager::Process()
+void AnalManager::PrintSampleEstimates()
 {
-  for (auto ext : mAnalExs) ext->BookHistos();
+  // Pass count n estimates n / f, errors from per-key totals, see
+  // SampleVariance().
 
-  mChnN = mChn->GetEntries();
+  const Double_t f = mSampleFraction;
 
-  const Int_t NDiv = TMath::Power(10, TMath::Floor(TMath::Log10(mChnN) - 4));
+  printf("\nSampled %.4g%% by %s, %zu keys kept, estimated pass counts:\n", 100 * f,
+         mSampleByUser ? "user and file name" : "file name", mSampleKeyPass.size());
 
-  printf("AnalManager::Process(), going over %lld entries ...\n", mChnN);
+  size_t c = 0;
+  auto est = [&](const char *type, AnalFilter *flt)
+  {
+    const Double_t n = flt->GetPassCount();
+    printf("%-9s %-24s = %'14.0f +- %'12.0f\n", type, flt->RefName().Data(),
+           n / f, TMath::Sqrt(SampleVariance(c++)));
+  };
+
+  est("Manager", this);
+  for (auto ext : mAnalExs) est("Extractor", ext);
+  for (auto fil : OrderedFilters()) est("Filter", fil);
+}
 
-  for (mChnI = 0; mChnI < mChnN; ++mChnI)
+void AnalManager::PrintReadStats()
+{
+  printf("\n");
+  printf("Read cache size                    = %'12lld\n", mCacheSize);
+  printf("Read cache hit rate                = %12.4f\n", mCacheHitRate);
+  printf("Read wait time [s]                 = %12.2f%s\n", mReadTime.f_wall,
+         mNThreads > 1 ? " (sum over threads)" : "");
+  printf("Bytes read from files              = %'12lld\n", TFile::GetFileBytesRead());
+  printf("Bytes decompressed                 = %'12lld\n", mNBytes);
+  if (mPipelineDepth > 0)
   {
-    // Progress report
-    if (mChnI % NDiv == 0)
+    // Reader waiting means extractors are the bottleneck, and vice versa.
+    printf("Pipeline depth                     = %12d\n", mPipelineDepth);
+    printf("Pipeline reader / extract waits    = %'12lld / %'lld\n", mReadWaits, mExtractWaits);
+  }
+  if (mProcessWall > 0)
+  {
+    printf("Event loop wall time [s]           = %12.2f\n", mProcessWall);
+    printf("Events / s                         = %12.0f\n", mNRead / mProcessWall);
+    printf("Decompressed MB / s                = %12.2f\n", mNBytes / mProcessWall / 1048576);
+  }
+  if (mImtOn)
+  {
+    printf("Implicit MT threads                = %12u\n", ROOT::GetThreadPoolSize());
+    const Double_t n0 = mImtNRead0 - mImtNReadS, w0 = mImtWall0 - mImtWallS;
+    const Double_t r0 = mImtReadWall0 - mImtReadWallS;
+    if (n0 > 0 && mNRead > mImtNRead0 && r0 > 0 && w0 > 0)
     {
-      // printf("%lld ", mChnI);
-      if (mOnTty)
-      {
-        printf("\x1b[2K\x1b[31mProgress: %5.2f%%\x1b[0m\x1b[0E", 100*(double)mChnI/mChnN);
-        fflush(stdout);
-      }
+      // GetEntry rate is the one IMT affects, event rate includes the rest.
+      const Double_t n1 = mNRead - mImtNRead0, w1 = mProcessWall - mImtWall0;
+      const Double_t r1 = mReadTime.f_wall - mImtReadWall0;
+      printf("Calibration entries without IMT    = %'12lld\n", (Long64_t) n0);
+      printf("Events / s, without / with IMT     = %12.0f / %.0f\n",
+             n0 / w0, n1 / w1);
+      printf("GetEntry MB / s, without / with IMT= %12.2f / %.2f\n",
+             (mImtNBytes0 - mImtNBytesS) / r0 / 1048576, (mNBytes - mImtNBytes0) / r1 / 1048576);
     }
+  }
+}
 
-    mChn->GetEntry(mChnI);
+void AnalManager::PrintCutFlow()
+{
+  vpAnalFilter_t fis = OrderedFilters();
+  const Int_t    n   = fis.size();
 
+  if (n == 0 || mFiMaskCounts.empty()) return;
 
-    // Extract commonly used data & filter out crap
-    if ( ! FilterAndStore())
+  // Entries passing all terms, counting only those where all were evaluated.
+  auto count = [this](ULong64_t req, ULong64_t forb)
+  {
+    const ULong64_t all = req | forb;
+    Long64_t c = 0;
+    for (auto &mc : mFiMaskCounts)
     {
-      continue;
+      ULong64_t eval = mc.first.first, pass = mc.first.second;
+      if ((eval & all) == all && (pass & req) == req && (pass & forb) == 0)
+        c += mc.second;
     }
+    return c;
+  };
+
+  const Long64_t n_all = count(0, 0);
 
-    // Call filters
-    for (auto flt : mAnalFis)
+  printf("\n");
+  if (mExactFilterCounts)
+  {
+    for (auto ext : mAnalExs)
     {
-      flt->FilterAndStore();
+      printf("Cut-flow of extractor %s\n", ext->RefName().Data());
+      printf("  %-32s = %'12lld  %7.3f%%\n", "Manager", n_all, 100.0);
+
+      ULong64_t req = 0, forb = 0;
+      auto line = [&](AnalFilter *f, bool anti)
+      {
+        (anti ? forb : req) |= f->BitMask();
+        Long64_t c = count(req, forb);
+        printf("  %-32s = %'12lld  %7.3f%%\n", ((anti ? "! " : "") + f->RefName()).Data(),
+               c, n_all > 0 ? 100.0 * c / n_all : 0);
+      };
+      for (auto f : ext->mFilters)     line(f, false);
+      for (auto f : ext->mAntiFilters) line(f, true);
     }
+  }
+  else
+  {
+    printf("Cut-flow not available, requires SetExactFilterCounts(true).\n");
+  }
 
-    // Call extractors
-    for (auto ext : mAnalExs)
+  // Row i, column j: % of entries passing i that also pass j.
+  std::vector<Long64_t> n_pass (n * n, 0);
+  std::vector<Long64_t> n_both (n * n, 0);
+  for (auto &mc : mFiMaskCounts)
+  {
+    ULong64_t eval = mc.first.first, pass = mc.first.second;
+    for (Int_t i = 0; i < n; ++i)
     {
-      if (ext->FilterAndStore())
+      if ( ! (pass & (1ull << i))) continue;
+      for (Int_t j = 0; j < n; ++j)
       {
-        ext->Process();
+        if ( ! (eval & (1ull << j))) continue;
+        n_pass[i * n + j] += mc.second;
+        if (pass & (1ull << j)) n_both[i * n + j] += mc.second;
       }
     }
   }
 
-  printf("%sDone!\n\n", mOnTty ? "\n" : "");
-
-  for (auto ext : mAnalExs) ext->WriteHistos();
-
-  // XXXX Output entry lists
-
-  // Print pass counts from all extractors and filters.
+  printf("\nFilter correlations, %% of entries passing row filter that pass column filter");
+  printf("%s\n", mExactFilterCounts ? ":" : ",\nover entries where both were evaluated:");
+  printf("%-28s", "");
+  for (Int_t j = 0; j < n; ++j) printf("  %5d", j);
   printf("\n");
-  printf("Manager pass count                 = %'12lld\n", GetPassCount());
-  for (auto ext : mAnalExs)
-    printf("Extractor %-24s = %'12lld\n", ext->RefName().Data(), ext->GetPassCount());
-
-  for (auto fil : mAnalFis)
-    printf("Filter    %-24s = %'12lld\n", fil->RefName().Data(), fil->GetPassCount());
-
+  for (Int_t i = 0; i < n; ++i)
+  {
+    printf("%2d %-25s", i, fis[i]->RefName().Data());
+    for (Int_t j = 0; j < n; ++j)
+    {
+      if (n_pass[i * n + j] > 0)
+        printf("  %5.1f", 100.0 * n_both[i * n + j] / n_pass[i * n + j]);
+      else
+        printf("  %5s", "-");
+    }
+    printf("\n");
+  }
 }
 
 
@@ -286,14 +3103,14 @@ void SetupAaaTest(AnalManager& M)
 
   auto fi_Remote = new AnFiDomain("RemoteAccess", M, "", AT_remote);
 
-  auto fi_ND_All = new AnFiAnyFoo("ReadFromND",  M, [&M]() {
-      return M.mUDomain.EndsWith("nd.edu"); });
+  auto fi_ND_All = new AnFiAnyFoo("ReadFromND",  M, [](AnalManager& M) {
+      return M.mUDomain.EndsWith("nd.edu"); }, {});
 
-  auto fi_UNL = new AnFiAnyFoo("ServeFromUNL",  M, [&M]() {
-      return M.mSDomain.EndsWith("unl.edu"); });
+  auto fi_UNL = new AnFiAnyFoo("ServeFromUNL",  M, [](AnalManager& M) {
+      return M.mSDomain.EndsWith("unl.edu"); }, {});
 
-  auto fi_UCSD = new AnFiAnyFoo("ServeFromUCSD",  M, [&M]() {
-      return M.mSDomain.EndsWith("ucsd.edu"); });
+  auto fi_UCSD = new AnFiAnyFoo("ServeFromUCSD",  M, [](AnalManager& M) {
+      return M.mSDomain.EndsWith("ucsd.edu"); }, {});
 
   auto ex_All = new AnExIo("AllND", M);
   ex_All->AddFilter(fi_ND_All);
@@ -332,7 +3149,8 @@ void SetupAaaUsa1(AnalManager& M)
 
   auto fi_Frac10 = new AnFiValueCut<double>
     ("FractionMoreThan10p", M, VC_greater_than, 0.1,
-     [&M]() { return M.F.mReadStats.mSumX / M.F.mSizeMB; }
+     [](AnalManager& M) { return M.F.mReadStats.mSumX / M.F.mSizeMB; },
+     { "F.mReadStats", "F.mSizeMB" }
     );
 
   auto ex_All = new AnExIo("All", M);
@@ -392,11 +3210,12 @@ void SetupAaaIov(AnalManager& M)
   auto fi_InUsa  = new AnFiUsa("InUsa", M, AT_local);
   auto fi_AodSim = new AnFiAodAodsim("AodAodSim", M);
 
-  auto fi_YesVread  = new AnFiAnyFoo("YesVread",  M, [&M]() {
-      return M.F.mVecReadStats.mN > 0; });
+  auto fi_YesVread  = new AnFiAnyFoo("YesVread",  M, [](AnalManager& M) {
+      return M.F.mVecReadStats.mN > 0; }, { "F.mVecReadStats" });
 
-  auto fi_Vread60p  = new AnFiAnyFoo("Vread60p",  M, [&M]() {
-      return M.F.mVecReadStats.mSumX / M.F.mReadStats.mSumX >= 0.6; });
+  auto fi_Vread60p  = new AnFiAnyFoo("Vread60p",  M, [](AnalManager& M) {
+      return M.F.mVecReadStats.mSumX / M.F.mReadStats.mSumX >= 0.6; },
+    { "F.mVecReadStats", "F.mReadStats" });
 
   auto fi_CrappyIov = new AnFiCrappyIov("CrappyIov", M);
 
@@ -450,11 +3269,12 @@ void SetupAaaCacheSim(AnalManager& M)
   auto fi_InUsa  = new AnFiUsa("InUsa", M, AT_local);
   auto fi_AodSim = new AnFiAodAodsim("AodAodSim", M);
 
-  auto fi_YesVread  = new AnFiAnyFoo("YesVread",  M, [&M]() {
-      return M.F.mVecReadStats.mN > 0; });
+  auto fi_YesVread  = new AnFiAnyFoo("YesVread",  M, [](AnalManager& M) {
+      return M.F.mVecReadStats.mN > 0; }, { "F.mVecReadStats" });
 
-  auto fi_Vread60p  = new AnFiAnyFoo("Vread60p",  M, [&M]() {
-      return M.F.mVecReadStats.mSumX / M.F.mReadStats.mSumX >= 0.6; });
+  auto fi_Vread60p  = new AnFiAnyFoo("Vread60p",  M, [](AnalManager& M) {
+      return M.F.mVecReadStats.mSumX / M.F.mReadStats.mSumX >= 0.6; },
+    { "F.mVecReadStats", "F.mReadStats" });
 
   auto fi_CrappyIov = new AnFiCrappyIov("CrappyIov", M);
 
@@ -465,6 +3285,9 @@ void SetupAaaCacheSim(AnalManager& M)
   ex_CacheSim->AddFilter(fi_IovNonLoc);
   ex_CacheSim->AddFilter(fi_YesVread);
   ex_CacheSim->AddFilter(fi_CrappyIov);
+  // Selection is the same for all cache settings, skim once and then
+  // run over CacheSim-skim.root.
+  // ex_CacheSim->SetSkim();
 
   auto ex_CacheSimVec60 = new AnExCacheSim("CacheSimVec60", M, "", 0.6);
   ex_CacheSimVec60->AddFilter(fi_InUsa);
@@ -488,9 +3311,9 @@ void SetupAaaFnalRal(AnalManager& M)
 
   M.AddPreFilter(pf_AaaMon);
 
-  auto fi_FnalToRal  = new AnFiAnyFoo("FnalToRal",  M, [&M]() {
+  auto fi_FnalToRal  = new AnFiAnyFoo("FnalToRal",  M, [](AnalManager& M) {
       return M.U.mFromDomain.EndsWith("rl.ac.uk") && M.S.mDomain.EndsWith("fnal.gov");
-    });
+    }, {});
 
   auto ex_FnalToRal = new AnExIo("FnalToRal", M);
   ex_FnalToRal->AddFilter(fi_FnalToRal);
@@ -505,11 +3328,14 @@ void SetupAaaFnalRal(AnalManager& M)
 AnalManager* setup_iov()
 {
   AnalManager *mgp = new AnalManager("Mgr", "Iov-3", "XrdFar", "/bar/xrdmon-xxx-merged/");
+  // Files split with repack_xrdfar -s, I. in io/ next to them:
+  // AnalManager *mgp = new AnalManager("Mgr", "Iov-3", "XrdFar", "/bar/xrdmon-xxx-repacked/", false);
+  // mgp->SetIoFriend(true);
   AnalManager &mgr = *mgp;
 
   mgr.AddFile("*.root");
   mgr.SetEdgeTimes(1359748800, 1393661701);
-  //   mgr.ScanEdgeTimes();
+  //   mgr.ScanEdgeTimesExact(0, 1e-6);
 
   //mgr.AddFile("*-2014-*.root");
   //mgr.SetEdgeTimes(1388563336, 1393661701);
@@ -527,12 +3353,15 @@ AnalManager* setup_cache_sim()
 
   mgr.AddFile("*.root");
   mgr.SetEdgeTimes(1359748800, 1393661701);
-  //   mgr.ScanEdgeTimes();
+  //   mgr.ScanEdgeTimesExact(0, 1e-6);
 
   //mgr.AddFile("*-2014-*.root");
   //mgr.SetEdgeTimes(1388563336, 1393661701);
   //   mgr.ScanEdgeTimes();
 
+  // Only go over entries that passed CrappyIov in a run with entry lists.
+  // mgr.UseEntryList("CacheSim-2/entry_lists.root", "Filters/CrappyIov");
+
   SetupAaaCacheSim(mgr);
 
   return mgp;
@@ -546,6 +3375,8 @@ AnalManager* setup_all_krappe()
   // BEWARE: There are entries with stoopid open/close times and durations.
   // ScanEdgeTimes() only looks at 100k first / last entries.
   // Make sure the values returned make sense !!!
+  // ScanEdgeTimesExact() looks at all entries, use reject_frac to get rid
+  // of outliers.
 
   /*
   // TEST RUN:
@@ -577,6 +3408,8 @@ AnalManager* setup_aaa_test()
   // BEWARE: There are entries with stoopid open/close times and durations.
   // ScanEdgeTimes() only looks at 100k first / last entries.
   // Make sure the values returned make sense !!!
+  // ScanEdgeTimesExact() looks at all entries, use reject_frac to get rid
+  // of outliers.
 
   /*
   // TEST RUN:
@@ -594,9 +3427,15 @@ AnalManager* setup_aaa_test()
   //mgr.AddFile("xmfar-2014-07-*.root");
   // mgr.SetEdgeTimes(1399010400, 1406642400);
 
+  // Sidecar indices give entry counts and time ranges without opening the
+  // files. A time window also skips files and entry blocks outside of it.
+  // mgr.SetFileIndex(true);
+  // mgr.SetTimeWindow(1406073600, 1406246400);
+
   mgr.AddFile("xmfar-2014-07-23-*.root");
   mgr.AddFile("xmfar-2014-07-24-*.root");
-  mgr.ScanEdgeTimes();
+  mgr.ScanEdgeTimesExact(0, 1e-6);
+  // mgr.SetEdgeTimesFromIndex();
 
   SetupAaaTest(mgr);
 
@@ -607,16 +3446,62 @@ AnalManager* setup_aaa_test()
   g++ `root-config --cflags --libs` -Wl,-rpath=. AnalManager.cxx libSXrdClasses.so
 */
 
-int main()
+int main(int argc, char *argv[])
 {
   setlocale(LC_NUMERIC, "en_US");
 
+  // Usage:
+  //   analX                      -- full run
+  //   analX <shard> <n_shards>   -- one shard of a split job
+  //   analX merge <out_dir> [n_threads] -- merge shards of a split job
+  //   analX resume [<shard> <n_shards>] -- continue from last checkpoint
+  //   analX incremental          -- only new files, merged into previous results
+
+  if (argc >= 2 && TString(argv[1]) == "resume")
+  {
+    AnalManager::SetResume(true);
+    --argc; ++argv;
+  }
+  else if (argc == 2 && TString(argv[1]) == "incremental")
+  {
+    AnalManager::SetIncremental(true);
+    --argc; ++argv;
+  }
+
+  if (argc >= 3 && TString(argv[1]) == "merge")
+  {
+    AnalMerger merger(argv[2], argc >= 4 ? atoi(argv[3]) : 0);
+    merger.Merge();
+    return 0;
+  }
+  if (argc == 3)
+  {
+    AnalManager::SetShard(atoi(argv[1]), atoi(argv[2]));
+  }
+  else if (argc != 1)
+  {
+    fprintf(stderr, "Usage: %s [resume] [<shard> <n_shards> | merge <out_dir> [n_threads]] | incremental\n", argv[0]);
+    return 1;
+  }
+
   // AnalManager &mgr = * setup_iov();
   // AnalManager &mgr = * setup_cache_sim();
   // AnalManager &mgr = * setup_all_krappe();
 
   AnalManager &mgr = * setup_aaa_test();
 
+  // mgr.SetNThreads(32);
+  // mgr.SetStoreEntryLists(true);
+  // mgr.SetCheckpoint(600);
+  // mgr.SetPipeline(64);
+  // mgr.SetExtractorThreads(3);
+  // mgr.SetImplicitMT(8, 100000);
+  // mgr.SetSampling(0.01);
+  // mgr.SetShuffle(true);
+  // mgr.SetSnapshots(900);
+  // mgr.SetStream("unix:/tmp/xrdfar.sock", 600);
+  // mgr.SetMetricsFile("/var/lib/node_exporter/textfile/anxrdmon.prom");
+
   mgr.Process();
 
   delete &mgr;
@@ -3,6 +3,13 @@
 
 #include "AnalFilter.h"
 #include "AnalExtractor.h"
+#include "AnalPrefetcher.h"
+#include "AnalSnapshotWriter.h"
+#include "AnalFileIndex.h"
+#include "AnalEvent.h"
+#include "AnalQueue.h"
+#include "AnalFanOut.h"
+#include "AnalWorkQueue.h"
 
 #include "SXrdClasses.h"
 
@@ -10,45 +17,237 @@
 
 #include <vector>
 #include <set>
-
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <climits>
 
 class TChain;
+class TTree;
+class TBranch;
 class TFile;
 
-class AnalManager : private AnalFilter
+//==============================================================================
+// AnalManagerConfig
+//==============================================================================
+
+// Settings of AnalManager shared by the master and its worker replicas,
+// which copy them. Master-only settings (threads, implicit MT, metrics,
+// stream, file index, input entry list) stay in AnalManager.
+
+struct AnalManagerConfig
 {
-  TChain           *mChn;
-  Long64_t          mChnN;
-  Long64_t          mChnI;
-  // XXX
+  // I. in friend files, see SetIoFriend().
+  Bool_t      mIoFriend           = false;
+  TString     mIoFriendDir;
+
+  // Read-ahead, see SetReadCache() and SetPrefetchNextFile().
+  Long64_t    mCacheSize          = 0;
+  Int_t       mCacheLearnEntries  = 0;
+  Bool_t      mPrefetchNextFile   = false;
+
+  // See SetTimeWindow().
+  Long64_t    mWindowMin          = LLONG_MIN;
+  Long64_t    mWindowMax          = LLONG_MAX;
+
+  // See SetCheckpoint(), SetSnapshots() and SetShuffle().
+  Double_t    mCheckpointInterval = 0;
+  Double_t    mSnapInterval       = 0;
+  Long64_t    mSnapEvery          = 0;
+  Bool_t      mShuffle            = false;
+  ULong64_t   mShuffleSeed        = 0;
+
+  Bool_t      mStoreEntryLists    = false;
+
+  // Deterministic subsampling, see SetSampling().
+  Double_t    mSampleFraction     = 1; // 1 when off
+  Bool_t      mSampleByUser       = false;
+  ULong64_t   mSampleBasis        = 0; // hash state after the seed
+  ULong64_t   mSampleThreshold    = 0;
+
+  // See SetPipeline() and SetExtractorThreads().
+  Int_t       mPipelineDepth      = 0;
+  Int_t       mExtractorThreads   = 0;
+
+  Bool_t      mBranchIActive      = true;
+  Bool_t      mPruneBranches      = true;
+  Bool_t      mLazyIo             = true;  // Requested, see SetLazyIoInfo().
+  Bool_t      mExactFilterCounts  = false; // See SetExactFilterCounts().
+};
+
+//==============================================================================
+// AnalManager
+//==============================================================================
+
+class AnalManager : private AnalFilter, protected AnalManagerConfig
+{
+  TChain           *mChn        = 0;
+  Long64_t          mChnN       = -1;
+  Long64_t          mChnI       = -1;
   // For entry-lists need current tree and current index.
-  // Then, need to detect tree change and notify all filters.
-  // TTree    *mTree
-  // Long64_t  mTreeI;
+  // Filters are notified of tree change in NotifyTreeChange().
+  TTree            *mTree       = 0;
+  Long64_t          mTreeI      = -1;
+  std::atomic<Int_t> mTreeNumber{-1};  // Read by the master for metrics.
+  TBranch          *mBranchI    = 0;
+
+  // I. friend chain, see SetIoFriend(). Attached on first use.
+  TChain           *mIoChn      = 0;
 
   TString           mInFilePrefix;
   TString           mOutDirName;
 
+  AnalManager      *mMaster     = 0;   // Set for worker replicas.
+  Int_t             mWorkerId   = -1;
+  Int_t             mNThreads   = 1;
+
+  std::map<AnalFilter*, AnalFilter*> mReplicaMap; // master -> own filters
+  std::atomic<Long64_t>              mNDone{0};   // for progress report
+
+  // Entries to process, from mWorkQueue if set, else mRangesToDo.
+  AnalWorkQueue    *mWorkQueue  = 0;
+  vRange_t          mRangesToDo;
+  size_t            mRangeI     = 0;
+
+  // Read-ahead statistics
+  AnalPrefetcher   *mPrefetcher = 0;
+  vTString_t        mActiveBranches;
+
+  // Sidecar file indices
+  Bool_t            mUseFileIndex   = false;
+  TString           mIndexDir;
+  std::vector<AnalFileIndex> mFileIndices;
+  Bool_t            mHasEntryRanges = false;
+  vRange_t          mEntryRanges;
+
+  // Shard of a job split over several processes, see SetShard().
+  static Int_t      sShardI, sNShards;
+  static Bool_t     sResume;
+  static Bool_t     sIncremental;
+
+  // Incremental mode, see SetIncremental().
+  TString           mPrevOutDir;
+  std::map<TString, std::pair<Long64_t, Long64_t>> mManifest; // file -> size, mtime
+  Long64_t          mPrevMinT = 0, mPrevMaxT = 0;
+
+  // Checkpointing, see SetCheckpoint().
+  std::chrono::steady_clock::time_point mLastCheckpoint;
+  Long64_t          mNAssigned  = 0;   // entries in ranges given to ProcessRanges()
+
+  // In-flight snapshots, see SetSnapshots() and SetShuffle().
+  Int_t             mSnapI      = 0;
+  Long64_t          mNextSnapN  = 0;
+  TString           mSnapPrev;
+  std::chrono::steady_clock::time_point mLastSnapshot;
+  AnalSnapshotWriter *mSnapWriter = 0; // The master's, shared by workers.
+  Long64_t          mNTotal     = 0;   // Entries to process, all threads.
+  // Shuffled runs: sums over completed work units of their size N and
+  // pass counts T (manager, extractors, filters) for snapshot errors.
+  Long64_t          mNUnits = 0, mUnitsDone = 0;
+  Double_t          mUnitN  = 0, mUnitN2    = 0;
+  std::vector<Double_t> mUnitT, mUnitT2, mUnitTN;
+  std::vector<Long64_t> mUnitPassBefore;
+
+  // Live input instead of the chain, see SetStream().
+  TString           mStreamSource;
+  Double_t          mStreamIdle = 0;
+
+  // Monitoring, see SetMetricsFile().
+  TString           mMetricsFile;
+  Double_t          mMetricsInterval = 0;
+  std::chrono::steady_clock::time_point mLastMetrics;
+  Long64_t          mMetricsPrevN = 0, mMetricsPrevBytes = 0;
+  // Worker: extractor pass counts as of its last progress point, read by
+  // the master for metrics while the worker keeps counting.
+  std::mutex        mPubMutex;
+  std::vector<Long64_t> mPubExPass;
+
+  // Input entry list, see UseEntryList().
+  TString           mInElFile, mInElName;
+
+  // Sampling, see SetSampling().
+  std::vector<TBranch*> mSampleBranches; // key branches, read first
+  // Pass counts of manager, extractors and filters per kept key, the
+  // sampling unit, for errors of the estimates. Filters are placed by
+  // GetBit(), the same in worker replicas, see PassCounts().
+  std::unordered_map<ULong64_t, std::vector<Long64_t>> mSampleKeyPass;
+  std::vector<Long64_t> mSamplePassBefore;
+
+  // Pipelined event loop, see SetPipeline().
+  AnalStageTime     mDeriveTime;       // Derive stage of the pipeline
+  Long64_t          mReadWaits    = 0; // Reader waited for a free event
+  Long64_t          mExtractWaits = 0; // Extract stage waited for input
+
+  // Concurrent extractors, see SetExtractorThreads().
+  AnalFanOut       *mFanOut = 0;
+  vpAnalExtractor_t mFanExs;        // Passing extractors of current entry
+
+  // ROOT implicit MT for decompression, see SetImplicitMT().
+  Int_t             mImtThreads      = -1;         // -1 for off
+  Long64_t          mImtCalibEntries = 0;
+  Bool_t            mImtOn           = false;
+  Long64_t          mImtStartAt      = 0;          // mNRead where calibration starts
+  Long64_t          mImtNReadS = 0, mImtNBytesS   = 0; // at start of calibration
+  Double_t          mImtWallS  = 0, mImtReadWallS = 0;
+  Long64_t          mImtNRead0 = 0, mImtNBytes0   = 0; // when it was turned on
+  Double_t          mImtWall0  = 0, mImtReadWall0 = 0;
+  std::chrono::steady_clock::time_point mLoopStart;
+
+  AnalStageTime     mReadTime;          // LoadEntry() and LoadIoInfo()
+  Double_t          mProcessWall  = 0;  // s of the whole event loop
+  Double_t          mResumedWall  = 0;  // s of it before a resume
+  Long64_t          mNBytes       = 0;  // decompressed bytes from GetEntry()
+  Double_t          mCacheHitRate = 0;  // TTreeCache hit rate over all files
+  Long64_t          mNRead        = 0;  // entries read
+
+  // Cache statistics go with the file, they are collected before the chain
+  // leaves it, see CollectCacheStats().
+  Long64_t          mTreeBeg = 0, mTreeEnd = 0; // chain entries of current tree
+  Long64_t          mTreeNRead  = 0;            // entries read from it
+  Double_t          mCacheHits  = 0;            // hit rate x entries, summed over files
+  Long64_t          mCacheNRead = 0;
+
   vpAnalFilter_t    mPreFilters;   // Results not stored.
 
   vpAnalExtractor_t mAnalExs;
   spAnalFilter_t    mAnalFis;
 
+  // Results of filters in mAnalFis for the current entry, bit i is filter
+  // with AnalFilter::GetBit() == i. Pass bits are only valid where the
+  // eval bit is set.
+  ULong64_t         mFiEvalMask = 0, mFiPassMask = 0;
+
+  // Entries passing the manager per (eval, pass) mask pair, for the
+  // cut-flow and correlation printout.
+  std::map<std::pair<ULong64_t, ULong64_t>, Long64_t> mFiMaskCounts;
+
 public:
   TChain*        GetChain()           { return mChn;  }
   Long64_t       GetChainN()          { return mChnN; }
   Long64_t       GetChainI()          { return mChnI; }
-  // TTree*         GetTree()        { return ; }
+  TTree*         GetTree()            { return mTree;  }
+  Long64_t       GetTreeI()           { return mTreeI; }
 
   const TString& RefOutDirName() const { return mOutDirName; }
 
-  SXrdFileInfo      F, *_fp;
-  SXrdUserInfo      U, *_up;
-  SXrdServerInfo    S, *_sp;
-  SXrdIoInfo        I, *_ip;
+  ULong64_t      GetFilterEvalMask() const { return mFiEvalMask; }
+  ULong64_t      GetFilterPassMask() const { return mFiPassMask; }
+  void           SetFilterResult(ULong64_t bit, bool pass)
+  { mFiEvalMask |= bit; if (pass) mFiPassMask |= bit; }
+
+  bool           IsWorker()    const { return mMaster != 0; }
+  Int_t          GetWorkerId() const { return mWorkerId; }
+
+  SXrdFileInfo      F, *_fp = &F;
+  SXrdUserInfo      U, *_up = &U;
+  SXrdServerInfo    S, *_sp = &S;
+  SXrdIoInfo        I, *_ip = &I;
 
-  Bool_t      mBranchIActive;
-  Bool_t      mOnTty;
+  Bool_t      mDeferIo  = false; // Lazy I. in effect for this run.
+  Bool_t      mIoLoaded = false; // I. read for current entry.
+  Bool_t      mOnTty    = false;
 
   // Whole data-set constants
   Long64_t    mMinT, mMaxT;
@@ -59,11 +258,90 @@ public:
   // Per event variables
   Double_t    mDt;
 
-  TPMERegexp  mSDomainRe;
-  TPMERegexp  mUDomainRe;
   TString     mSDomain, mUDomain;
+  vTString_t  mPathParts;   // F.mName split at '/', [0] is empty.
 
-  TPMERegexp  mSlashRe;
+  AnalEventDeriver mDeriver;
+
+  // Component n of the file path, empty if there are fewer.
+  const TString& PathPart(Int_t n) const
+  {
+    static const TString s_empty;
+    return n < (Int_t) mPathParts.size() ? mPathParts[n] : s_empty;
+  }
+
+protected:
+  AnalManager(AnalManager& master, Int_t worker_id);
+
+  void SetBranchAddresses();
+  void SetupBranchStatus();
+  void AttachIoFriend();
+
+  void CreateEntryLists();
+  void WriteEntryLists();
+  void ApplyInputEntryList(vRange_t& ranges);
+  void ApplyShard(vRange_t& ranges);
+  void WriteCounts();
+
+  bool ReadManifest(const TString& dir);
+  void WriteManifest();
+  // Input, read volume, stage times, peak RSS and per filter / extractor
+  // counts and times as <out_dir>/run_report.json.
+  void WriteRunReport();
+  void FilterProcessedFiles(std::vector<TString>& names);
+
+  TString        CheckpointName() const;
+  vpAnalFilter_t OrderedFilters() const;
+  void           WriteCheckpoint(Long64_t n_done);
+  Long64_t       ReadCheckpoint();
+  void           WriteSnapshot(Long64_t n_done);
+  void           ShuffleUnits(vRange_t& units) const;
+  bool           SnapshotDue(Long64_t n_done) const;
+  std::vector<Long64_t> PassCounts() const;
+  void           EndUnit(Long64_t n);
+  // Of the estimate of pass count c from the units done, ratio estimator.
+  Double_t       UnitVariance(size_t c) const;
+  bool           MetricsDue() const;
+  void           PublishCounts();
+  // Master only, workers are summed up from their replicas.
+  void           WriteMetrics(Long64_t n_done, Long64_t n_bytes,
+                              const std::vector<AnalManager*>& workers, bool done=false);
+
+  bool      InSample()  const { return SampleKey() < mSampleThreshold; }
+  void      CountSampleKey();
+  // Of the estimate of pass count c, 0 manager, then extractors, filters
+  // by bit.
+  Double_t  SampleVariance(size_t c) const;
+
+  void NotifyTreeChange();
+  void SetupTreeRead(bool first);
+  void CollectCacheStats();
+  void SetEntryListTrees(Int_t tree_number);
+  void StepImtCalib();
+  void EnableImt();
+  void LoadEntry();
+  void ProcessEntry();
+  void ProcessLoadedEntry();
+  void RunExtractor(AnalExtractor* ext);
+  void ReportProgress(Long64_t n_done);
+  void ProcessRange(Long64_t beg, Long64_t end);
+  bool NextRange(std::pair<Long64_t, Long64_t>& r);
+  void ReadStage(AnalQueue<AnalEvent*>& in, AnalQueue<AnalEvent*>& out);
+  void DeriveStage(AnalQueue<AnalEvent*>& in, AnalQueue<AnalEvent*>& out);
+  void SwapEvent(AnalEvent& ev);
+  void ProcessPipelined();
+
+  // Chain entries at which ROOT clusters start in files that have entries
+  // in ranges, plus mChnN. Opens those files.
+  std::vector<Long64_t> ClusterStarts(const vRange_t& ranges);
+  // Ranges cut at cluster boundaries, clusters of the same file merged
+  // until a unit has at least min_size entries.
+  vRange_t              WorkUnits(const vRange_t& ranges, Long64_t min_size);
+  void ProcessRanges(const vRange_t& ranges);
+  void ProcessParallel(const vRange_t& ranges);
+  // Entries of the chain to process, after shard, entry list and shuffle.
+  vRange_t PrepareRanges();
+  void ProcessStream();
 
 public:
 
@@ -72,16 +350,209 @@ public:
               bool setup_I_branch = true);
   virtual ~AnalManager();
 
+  // Process only shard i of n: consecutive files, or consecutive entries
+  // when there are fewer files than shards. Has to be called before the
+  // manager is constructed, output goes to <out_dir>/shard-<i>/. Edge times
+  // must come out the same in all shards, e.g. from ScanEdgeTimesExact()
+  // or the file index. Combine the shards with AnalMerger.
+  static void SetShard(Int_t i, Int_t n);
+
+  // Continue an interrupted run from its last checkpoint, see
+  // SetCheckpoint(). Has to be called before the manager is constructed,
+  // the existing output directory is then reused. Setup, number of threads
+  // and shard have to be the same as in the interrupted run.
+  static void SetResume(bool r) { sResume = r; }
+
+  // Only process files not listed in manifest.txt of an existing output
+  // directory. The old directory is renamed to <out_dir>.prev-<n>, its
+  // minimum edge time is kept and the maximum extended, its results are
+  // merged into the new ones at the end of Process(), see AnalMerger.
+  // Results of shard, sampled, entry range, entry list or time window runs
+  // are refused. Has to be called before the manager is constructed.
+  static void SetIncremental(bool i) { sIncremental = i; }
+  bool        IsResuming() const { return sResume; }
+
+  // Keep a deterministic fraction of entries, selected by a hash of
+  // F.mName, or of U.mRealName and F.mName with by_user, so that all
+  // accesses to a file (by a user) are kept or dropped together. The same
+  // fraction and seed give the same sample in every run. Counts stay raw,
+  // histograms and AnExIo per-hour totals are scaled by 1 / fraction
+  // before writing. The summary shows scaled pass counts and AnExIo
+  // per-hour totals get errors from per-key sums, as keys are what is
+  // sampled. Other histograms get binomial errors which treat entries as
+  // independent and are too small for files with many accesses.
+  // Outside the pipelined mode only the key branches are read for dropped
+  // entries.
+  void      SetSampling(Double_t fraction, bool by_user=false, ULong64_t seed=0);
+  bool      IsSampling()        const { return mSampleFraction < 1; }
+  Double_t  GetSampleFraction() const { return mSampleFraction; }
+  // Hash of the current entry that decides whether it is kept.
+  ULong64_t SampleKey() const;
+
+  // Use sidecar index files, see AnalFileIndex, to get entry counts and
+  // time ranges without opening the files. Indices are written into
+  // idx_dir, by default anidx/ in the working directory, and are rebuilt
+  // when a data file changes.
+  void SetFileIndex(bool use, const TString& idx_dir="");
+  // Drop files and blocks of entries outside of the window, needs to be
+  // called before AddFile(), turns on use of file index.
+  void SetTimeWindow(Long64_t min, Long64_t max);
+
   void AddFile(const TString& files);
 
+  // I. is not in the input files but in friend files of the same base name
+  // in io_dir (default io/ next to each input file), tree <tree_name>Io
+  // with the same entries, as written by repack_xrdfar -s. The friends are
+  // only attached when a filter or extractor uses I. Construct the manager
+  // with setup_I_branch = false.
+  void SetIoFriend(bool use, const TString& io_dir="");
+  static TString IoFriendName(const TString& file, const TString& io_dir);
+
   void AddPreFilter(AnalFilter*    flt);
+  // Filters of the extractor have to be added before, each distinct filter
+  // gets a bit in the filter masks, at most 64 of them.
   void AddExtractor(AnalExtractor* ext);
 
   void ScanEdgeTimes(Long64_t scan_entries=100000);
+  void ScanEdgeTimesExact(Int_t n_threads=0, Double_t reject_frac=0);
+  void SetEdgeTimesFromIndex();
   void SetEdgeTimes(Long64_t min, Long64_t max, bool verbose=true);
 
   virtual bool Filter();
 
+  // Only read branches declared via AnalFilter::UseBranch(), on by default.
+  void SetPruneBranches(bool p) { mPruneBranches = p; }
+
+  // Read I. branch only for entries where some filter or extractor using
+  // it gets evaluated. On by default, requires branch pruning, not done
+  // in pipelined mode.
+  void SetLazyIoInfo(bool l) { mLazyIo = l; }
+
+  // Filters are evaluated when an extractor needs them, see
+  // AnalExtractor::Filter(), so their counts and entry lists only cover
+  // such entries. With exact counts all filters are evaluated for all
+  // entries passing the manager, at the cost of speed.
+  void SetExactFilterCounts(bool e) { mExactFilterCounts = e; }
+
+  void LoadIoInfo();
+
+  // TTreeCache size in bytes, 0 to leave ROOT default. With learn_entries
+  // of 0 the cache is filled with active branches only and learning is
+  // stopped right away, otherwise ROOT learns for that many entries.
+  void SetReadCache(Long64_t size, Int_t learn_entries=0)
+  { mCacheSize = size; mCacheLearnEntries = learn_entries; }
+
+  // Read next file of the chain in a background thread to get it into
+  // the page cache before TChain opens it.
+  void SetPrefetchNextFile(bool p) { mPrefetchNextFile = p; }
+
+  void PrintReadStats();
+
+  // Pass counts scaled by 1 / sample fraction, see SetSampling().
+  void PrintSampleEstimates();
+
+  // Cut-flow of each extractor, in the order filters were added, and
+  // correlations between filters, from filter masks. The cut-flow needs
+  // SetExactFilterCounts(true).
+  void PrintCutFlow();
+
+  // Record passing entries of the manager, filters and extractors in
+  // TEntryLists, written to <out_dir>/entry_lists.root under Manager/,
+  // Filters/ and Extractors/. Turns on SetExactFilterCounts(), lists of
+  // lazily evaluated filters would depend on their order.
+  void SetStoreEntryLists(bool s) { mStoreEntryLists = s; }
+
+  // Only process entries in list 'name' (e.g. "Filters/CrappyIov") from
+  // entry_lists.root of an earlier run over the same files.
+  void UseEntryList(const TString& file, const TString& name)
+  { mInElFile = file; mInElName = name; }
+
+  // Managers are replicated with the worker constructor.
+  virtual AnalFilter* Clone(AnalManager&) const { return 0; }
+
+  // Number of worker threads, each gets its own chain and replicas of all
+  // filters and extractors. Results are merged at the end of Process().
+  // Work is handed out in cluster-aligned units, workers start on a
+  // consecutive block each and steal from others when done. With
+  // checkpointing the blocks are kept fixed.
+  void SetNThreads(Int_t n) { mNThreads = n; }
+
+  // Run reading, derivation of domains / path / duration, and filters with
+  // extractors in three threads connected by queues of depth recycled
+  // events, so that decompression overlaps histogram filling. Also done
+  // in each worker with SetNThreads(). 0 turns it off. I. is then read
+  // for all entries when it is used at all, see SetLazyIoInfo().
+  void SetPipeline(Int_t depth) { mPipelineDepth = depth; }
+
+  // Let ROOT decompress branches of an entry in parallel on a pool of
+  // n_threads (0 for all cores) via ROOT::EnableImplicitMT(). The first
+  // cluster of the first file is read without it and not timed, it pays
+  // for opening and cache learning. The next calib_entries are read without
+  // it, the summary then compares event and GetEntry rates with and
+  // without. Serial loop only, ignored with
+  // SetNThreads(). ROOT parallelizes over branches in TTree::GetEntry(),
+  // I. read on demand by LoadIoInfo() gains nothing, see SetLazyIoInfo().
+  void SetImplicitMT(Int_t n_threads, Long64_t calib_entries=0)
+  { mImtThreads = n_threads; mImtCalibEntries = calib_entries; }
+
+  // Run Process() of extractors passing an entry concurrently, on n extra
+  // threads and the event loop one, before going to the next entry. Filters
+  // are still evaluated in the event loop. Helps with several heavy
+  // extractors (AnExCacheSim, AnExIov), costs n threads per manager and
+  // per worker, they spin briefly between entries and then sleep. 0 turns
+  // it off.
+  void SetExtractorThreads(Int_t n) { mExtractorThreads = n; }
+
+  // Every interval seconds save extractor state, counts, entry lists,
+  // filter mask and sample key counts, unit statistics, timings and chain
+  // position to <out_dir>/checkpoint[-w<id>].root, one per worker
+  // thread, and once more when a thread has done its ranges. Checkpoints
+  // are removed at the end of a successful run. A missing one on resume
+  // means nothing was done yet. Sampling and shuffle settings have to
+  // match on resume. Skims are not checkpointed.
+  void SetCheckpoint(Double_t interval) { mCheckpointInterval = interval; }
+
+  // While the loop runs, every interval seconds and / or every_n entries
+  // (0 to not use one of them) write pass counts and extractor state, as
+  // in checkpoints, to <out_dir>/snapshots/snapshot[-w<id>]-<k>.root,
+  // one series per worker thread. Histograms are raw. The loop only
+  // serializes into memory, writing happens in a background thread. With
+  // SetShuffle() or SetSampling() Estimates/ has pass counts projected to
+  // all entries. Errors come from pass counts per completed work unit
+  // (shuffle, not in the pipelined loop) and per kept key (sampling), the
+  // units of randomization. From the second snapshot on Convergence/
+  // has, per extractor, the largest shape change of a histogram since the
+  // previous one, meaningful for shuffled input only.
+  void SetSnapshots(Double_t interval, Long64_t every_n=0)
+  { mSnapInterval = interval; mSnapEvery = every_n; }
+
+  // Process cluster-aligned units of entries in an order shuffled with
+  // the seed, so that entries done at any point are a random sample of
+  // units and snapshots converge to the final result. Costs a file open
+  // per unit, about a thousand of them for the serial loop.
+  void SetShuffle(bool s, ULong64_t seed=0) { mShuffle = s; mShuffleSeed = seed; }
+
+  // Process records from a live source instead of the chain, see
+  // AnalStream: "unix:<path>" listens on a local socket, anything else is
+  // a file followed as it grows. Ends at an end-of-stream record or after
+  // idle_timeout seconds without data, 0 waits forever. Edge times must be
+  // set with SetEdgeTimes() to cover the expected records. Use
+  // SetSnapshots() to have extractor outputs flushed while it runs. Serial
+  // loop only; threads, pipeline, implicit MT, checkpoints, shuffle and
+  // entry lists are ignored. Files added to the chain are not read.
+  void SetStream(const TString& source, Double_t idle_timeout=0)
+  { mStreamSource = source; mStreamIdle = idle_timeout; }
+  bool IsStreaming() const { return ! mStreamSource.IsNull(); }
+
+  // Every interval seconds rewrite file, atomically via rename, with
+  // metrics in Prometheus text format: entries processed, entries / s and
+  // MB / s read since the previous update, current file of the chain (per
+  // worker thread), pass counts of extractors and resident memory. Meant
+  // for the textfile collector of node_exporter, name it <x>.prom. Counts
+  // of worker replicas are as of their last progress report.
+  void SetMetricsFile(const TString& file, Double_t interval=5)
+  { mMetricsFile = file; mMetricsInterval = interval; }
+
   void Process();
 
   // To get rid of ...
@@ -0,0 +1,660 @@
+#include "AnalMerger.h"
+#include "AnExIo.h"
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TClass.h>
+#include <TH1.h>
+#include <TTree.h>
+#include <TGraph.h>
+#include <TEntryList.h>
+#include <TParameter.h>
+#include <TSystem.h>
+#include <TROOT.h>
+#include <TMath.h>
+#include <TList.h>
+
+#include <thread>
+#include <atomic>
+#include <set>
+#include <algorithm>
+
+namespace
+{
+  bool same_axis(const TAxis *a, const TAxis *b)
+  {
+    return a->GetNbins() == b->GetNbins() &&
+           a->GetXmin()  == b->GetXmin()  && a->GetXmax() == b->GetXmax();
+  }
+
+  bool axis_offset(const TAxis *dst, const TAxis *src, Int_t &off)
+  {
+    // src has to lie on the bin grid of dst, off is the dst bin of src
+    // bin 0. Only uniform binning is handled.
+
+    if (dst->IsVariableBinSize() || src->IsVariableBinSize()) return false;
+
+    const Double_t w   = dst->GetBinWidth(1);
+    const Double_t eps = 1e-6 * w;
+    if (TMath::Abs(src->GetBinWidth(1) - w) > eps) return false;
+
+    const Double_t o = (src->GetXmin() - dst->GetXmin()) / w;
+    off = TMath::Nint(o);
+    return TMath::Abs(o - off) * w < eps && off >= 0 && off + src->GetNbins() <= dst->GetNbins();
+  }
+
+  Int_t map_bin(Int_t i, Int_t n_src, Int_t n_dst, Int_t off)
+  {
+    // Under / overflow of src only map when dst ends at the same edge.
+
+    if (i == 0)         return off == 0 ? 0 : -1;
+    if (i == n_src + 1) return off + n_src == n_dst ? n_dst + 1 : -1;
+    return i + off;
+  }
+
+  void add_extending(TH1 *dst, const TH1 *src)
+  {
+    // Time axes of dst extend those of src, on the same bin grid.
+
+    if (same_axis(dst->GetXaxis(), src->GetXaxis()) &&
+        same_axis(dst->GetYaxis(), src->GetYaxis()))
+    {
+      dst->Add(src);
+      return;
+    }
+
+    const bool is_2d = src->GetDimension() > 1;
+
+    Int_t ox = 0, oy = 0;
+    if ( ! axis_offset(dst->GetXaxis(), src->GetXaxis(), ox) ||
+        (is_2d && ! axis_offset(dst->GetYaxis(), src->GetYaxis(), oy)))
+    {
+      fprintf(stderr, "AnalMerger axes of '%s' are not aligned with the previous run. Dying ...\n",
+              dst->GetName());
+      exit(1);
+    }
+
+    // Sums for mean and RMS do not depend on binning.
+    Double_t ds[13] = { 0 }, ss[13] = { 0 };
+    dst->GetStats(ds);
+    src->GetStats(ss);
+
+    const Int_t nsx = src->GetNbinsX(), ndx = dst->GetNbinsX();
+    const Int_t nsy = is_2d ? src->GetNbinsY() : -1, ndy = is_2d ? dst->GetNbinsY() : -1;
+
+    for (Int_t iy = 0; iy <= nsy + 1; ++iy)
+    {
+      const Int_t jy = is_2d ? map_bin(iy, nsy, ndy, oy) : 0;
+
+      for (Int_t ix = 0; ix <= nsx + 1; ++ix)
+      {
+        const Int_t    sb = src->GetBin(ix, iy);
+        const Double_t c  = src->GetBinContent(sb);
+        const Double_t se = src->GetBinError(sb);
+        if (c == 0 && se == 0) continue;
+
+        const Int_t jx = map_bin(ix, nsx, ndx, ox);
+        if (jx < 0 || jy < 0)
+        {
+          fprintf(stderr, "AnalMerger '%s' of the previous run has under / overflow inside"
+                  " the new range. Dying ...\n", dst->GetName());
+          exit(1);
+        }
+
+        const Int_t    db = dst->GetBin(jx, jy);
+        const Double_t de = dst->GetBinError(db);
+        dst->SetBinContent(db, dst->GetBinContent(db) + c);
+        dst->SetBinError  (db, TMath::Sqrt(de*de + se*se));
+      }
+      if ( ! is_2d) break;
+    }
+
+    for (Int_t i = 0; i < 13; ++i) ds[i] += ss[i];
+    dst->PutStats(ds);
+    dst->SetEntries(dst->GetEntries() + src->GetEntries());
+  }
+}
+
+//==============================================================================
+
+AnalMerger::AnalMerger(const TString& out_dir, Int_t n_threads, Int_t fan_in) :
+  mOutDir(out_dir),
+  mNThreads(n_threads > 0 ? n_threads : std::max(1u, std::thread::hardware_concurrency())),
+  mFanIn(TMath::Max(2, fan_in))
+{}
+
+//==============================================================================
+
+void AnalMerger::Merge()
+{
+  vTString_t shards, files;
+
+  void *dh = gSystem->OpenDirectory(mOutDir);
+  if ( ! dh)
+  {
+    fprintf(stderr, "AnalMerger::Merge can not open directory '%s'. Dying ...\n", mOutDir.Data());
+    exit(1);
+  }
+  while (const char *e = gSystem->GetDirEntry(dh))
+  {
+    if (TString(e).BeginsWith("shard-")) shards.push_back(mOutDir + "/" + e);
+  }
+  gSystem->FreeDirectory(dh);
+
+  if (shards.empty())
+  {
+    fprintf(stderr, "AnalMerger::Merge no shard-* directories in '%s'. Dying ...\n", mOutDir.Data());
+    exit(1);
+  }
+  std::sort(shards.begin(), shards.end());
+
+  dh = gSystem->OpenDirectory(shards[0]);
+  while (const char *e = gSystem->GetDirEntry(dh))
+  {
+    TString name(e);
+    if (name.EndsWith(".root") && ! name.Contains("-skim")) files.push_back(name);
+  }
+  gSystem->FreeDirectory(dh);
+  std::sort(files.begin(), files.end());
+
+  printf("AnalMerger::Merge %d shards, %d files each, %d threads.\n",
+         (Int_t) shards.size(), (Int_t) files.size(), mNThreads);
+
+  ROOT::EnableThreadSafety();
+
+  for (auto &name : files)
+  {
+    vTString_t in;
+    for (auto &s : shards)
+    {
+      TString f = s + "/" + name;
+      if (gSystem->AccessPathName(f))
+      {
+        fprintf(stderr, "AnalMerger::Merge '%s' missing, shard failed? Dying ...\n", f.Data());
+        exit(1);
+      }
+      in.push_back(f);
+    }
+
+    TString out = mOutDir + "/" + name;
+
+    printf("Merging %s ...\n", name.Data());
+
+    TH1::AddDirectory(false);
+    if ( ! MergeFiles(in, out))
+    {
+      fprintf(stderr, "AnalMerger::Merge merging into '%s' failed. Dying ...\n", out.Data());
+      exit(1);
+    }
+    TH1::AddDirectory(true);
+
+    FinalizeAnExIo(out);
+  }
+
+  PrintCounts(mOutDir + "/anal_manager.root");
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalMerger::MergeFiles(const vTString_t& in, const TString& out)
+{
+  // Tree reduction, groups of each level are merged in parallel.
+
+  vTString_t level = in;
+  Int_t      round = 0;
+
+  do
+  {
+    const Int_t n_groups = (level.size() + mFanIn - 1) / mFanIn;
+
+    vTString_t next(n_groups);
+    for (Int_t g = 0; g < n_groups; ++g)
+    {
+      next[g] = (n_groups == 1) ? out : TString::Format("%s.r%d-%d.tmp", out.Data(), round, g);
+    }
+
+    std::atomic<Int_t>       next_group(0);
+    std::atomic<bool>        ok(true);
+    std::vector<std::thread> threads;
+
+    for (Int_t t = 0; t < TMath::Min(mNThreads, n_groups); ++t)
+    {
+      threads.emplace_back([&]()
+      {
+        Int_t g;
+        while ((g = next_group++) < n_groups)
+        {
+          vTString_t grp(level.begin() + g * mFanIn,
+                         level.begin() + TMath::Min((g + 1) * mFanIn, (Int_t) level.size()));
+          if ( ! MergeGroup(grp, next[g])) ok = false;
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+
+    // Inputs of later rounds are our temporaries.
+    if (round > 0)
+    {
+      for (auto &f : level) gSystem->Unlink(f);
+    }
+
+    if ( ! ok) return false;
+
+    level.swap(next);
+    ++round;
+  }
+  while (level.size() > 1);
+
+  return true;
+}
+
+bool AnalMerger::MergeGroup(const vTString_t& in, const TString& out)
+{
+  std::vector<TFile*>      fs;
+  std::vector<TDirectory*> ds;
+
+  bool ok = true;
+  for (auto &name : in)
+  {
+    TFile *f = TFile::Open(name);
+    if ( ! f)
+    {
+      fprintf(stderr, "AnalMerger::MergeGroup can not open '%s'.\n", name.Data());
+      ok = false;
+      break;
+    }
+    fs.push_back(f);
+    ds.push_back(f);
+  }
+
+  if (ok)
+  {
+    TFile *o = TFile::Open(out, "recreate");
+    if (o)
+    {
+      MergeDir(ds, o, false);
+      o->Close();
+      delete o;
+    }
+    else
+    {
+      fprintf(stderr, "AnalMerger::MergeGroup can not create '%s'.\n", out.Data());
+      ok = false;
+    }
+  }
+
+  for (auto f : fs) { f->Close(); delete f; }
+
+  return ok;
+}
+
+void AnalMerger::MergeDir(std::vector<TDirectory*>& in, TDirectory* out, bool in_counts)
+{
+  std::set<TString> done;
+
+  TIter next(in[0]->GetListOfKeys());
+  while (TKey *key = (TKey*) next())
+  {
+    TString name = key->GetName();
+
+    // Keys are sorted by cycle, highest first.
+    if ( ! done.insert(name).second) continue;
+
+    TString cname = key->GetClassName();
+    TClass *cl    = TClass::GetClass(cname);
+    if ( ! cl)
+    {
+      fprintf(stderr, "AnalMerger::MergeDir unknown class '%s' of '%s', skipping.\n",
+              cname.Data(), name.Data());
+      continue;
+    }
+
+    if (cl->InheritsFrom(TDirectory::Class()))
+    {
+      std::vector<TDirectory*> subs;
+      for (auto d : in)
+      {
+        TDirectory *sd = d->GetDirectory(name);
+        if ( ! sd)
+        {
+          fprintf(stderr, "AnalMerger::MergeDir directory '%s' missing in '%s'. Dying ...\n",
+                  name.Data(), d->GetPath());
+          exit(1);
+        }
+        subs.push_back(sd);
+      }
+      MergeDir(subs, out->mkdir(name), in_counts || name == "Counts");
+      continue;
+    }
+
+    // Skims are chained, graphs are rebuilt in FinalizeAnExIo().
+    if (cl->InheritsFrom(TTree::Class()) || cl->InheritsFrom(TGraph::Class())) continue;
+
+    TObject *obj = key->ReadObj();
+
+    // Histos of all shards at once, TH1::Merge() also takes differing axes.
+    TList hlist;
+
+    for (size_t i = 1; i < in.size(); ++i)
+    {
+      TObject *o = in[i]->Get(name);
+      if ( ! o)
+      {
+        fprintf(stderr, "AnalMerger::MergeDir '%s' missing in '%s'. Dying ...\n",
+                name.Data(), in[i]->GetPath());
+        exit(1);
+      }
+
+      if (cl->InheritsFrom(TH1::Class()))
+      {
+        hlist.Add(o);
+        continue;
+      }
+      else if (cl->InheritsFrom(TEntryList::Class()))
+      {
+        ((TEntryList*) obj)->Add((TEntryList*) o);
+      }
+      else if (cname == "TParameter<Long64_t>")
+      {
+        TParameter<Long64_t> *p = (TParameter<Long64_t>*) obj;
+        TParameter<Long64_t> *q = (TParameter<Long64_t>*) o;
+        if (in_counts)
+        {
+          p->SetVal(p->GetVal() + q->GetVal());
+        }
+        else if (p->GetVal() != q->GetVal())
+        {
+          fprintf(stderr, "AnalMerger::MergeDir '%s' differs between shards, %lld vs. %lld. Dying ...\n",
+                  name.Data(), p->GetVal(), q->GetVal());
+          exit(1);
+        }
+      }
+      else if (cname == "TParameter<Double_t>")
+      {
+        // E.g. Sampling/Fraction, results of different samples do not add up.
+        Double_t a = ((TParameter<Double_t>*) obj)->GetVal();
+        Double_t b = ((TParameter<Double_t>*) o)->GetVal();
+        if (a != b)
+        {
+          fprintf(stderr, "AnalMerger::MergeDir '%s' differs between shards, %g vs. %g. Dying ...\n",
+                  name.Data(), a, b);
+          exit(1);
+        }
+      }
+      else if (cname == "TNamed")
+      {
+        if (TString(obj->GetTitle()) != o->GetTitle())
+        {
+          fprintf(stderr, "AnalMerger::MergeDir '%s' differs between shards, '%s' vs. '%s'. Dying ...\n",
+                  name.Data(), obj->GetTitle(), o->GetTitle());
+          exit(1);
+        }
+      }
+      else if (i == 1)
+      {
+        fprintf(stderr, "AnalMerger::MergeDir do not know how to merge '%s' of class '%s', taking first.\n",
+                name.Data(), cname.Data());
+      }
+
+      delete o;
+    }
+
+    if (hlist.GetSize() > 0)
+    {
+      ((TH1*) obj)->Merge(&hlist);
+      hlist.Delete();
+    }
+
+    out->WriteTObject(obj, name);
+    delete obj;
+  }
+}
+
+//==============================================================================
+
+void AnalMerger::MergePrevious(const TString& prev_dir)
+{
+  vTString_t files;
+
+  void *dh = gSystem->OpenDirectory(prev_dir);
+  if ( ! dh)
+  {
+    fprintf(stderr, "AnalMerger::MergePrevious can not open directory '%s'.\n", prev_dir.Data());
+    return;
+  }
+  while (const char *e = gSystem->GetDirEntry(dh))
+  {
+    TString name(e);
+    if (name.EndsWith(".root") && ! name.Contains("-skim") && ! name.BeginsWith("checkpoint"))
+      files.push_back(name);
+  }
+  gSystem->FreeDirectory(dh);
+  std::sort(files.begin(), files.end());
+
+  printf("AnalMerger::MergePrevious adding %d files from '%s'.\n", (Int_t) files.size(), prev_dir.Data());
+
+  for (auto &name : files)
+  {
+    TString prev = prev_dir + "/" + name;
+    TString cur  = mOutDir  + "/" + name;
+
+    if (gSystem->AccessPathName(cur))
+    {
+      fprintf(stderr, "AnalMerger::MergePrevious '%s' not produced by this run, skipping it.\n",
+              name.Data());
+      continue;
+    }
+
+    TFile *src = TFile::Open(prev);
+    TFile *dst = TFile::Open(cur, "update");
+    if ( ! src || ! dst)
+    {
+      fprintf(stderr, "AnalMerger::MergePrevious can not open '%s' or '%s', skipping.\n",
+              prev.Data(), cur.Data());
+      delete src; delete dst;
+      continue;
+    }
+
+    TH1::AddDirectory(false);
+    AddDirExtending(src, dst, false);
+    TH1::AddDirectory(true);
+
+    dst->Close(); delete dst;
+    src->Close(); delete src;
+
+    FinalizeAnExIo(cur);
+  }
+
+  PrintCounts(mOutDir + "/anal_manager.root");
+}
+
+void AnalMerger::AddDirExtending(TDirectory* src, TDirectory* dst, bool in_counts)
+{
+  std::set<TString> done;
+
+  TIter next(src->GetListOfKeys());
+  while (TKey *key = (TKey*) next())
+  {
+    TString name = key->GetName();
+    if ( ! done.insert(name).second) continue;
+
+    TString cname = key->GetClassName();
+    TClass *cl    = TClass::GetClass(cname);
+    if ( ! cl) continue;
+
+    if (cl->InheritsFrom(TDirectory::Class()))
+    {
+      TDirectory *dd = dst->GetDirectory(name);
+      if ( ! dd) dd = dst->mkdir(name);
+      AddDirExtending(src->GetDirectory(name), dd, in_counts || name == "Counts");
+      continue;
+    }
+
+    if (cl->InheritsFrom(TTree::Class()) || cl->InheritsFrom(TGraph::Class())) continue;
+
+    TObject *so = key->ReadObj();
+    TObject *d  = dst->Get(name);
+
+    if ( ! d)
+    {
+      dst->WriteTObject(so, name);
+      delete so;
+      continue;
+    }
+
+    if (cl->InheritsFrom(TH1::Class()))
+    {
+      add_extending((TH1*) d, (TH1*) so);
+    }
+    else if (cl->InheritsFrom(TEntryList::Class()))
+    {
+      ((TEntryList*) d)->Add((TEntryList*) so);
+    }
+    else if (cname == "TParameter<Long64_t>")
+    {
+      TParameter<Long64_t> *p = (TParameter<Long64_t>*) d;
+      TParameter<Long64_t> *q = (TParameter<Long64_t>*) so;
+      if (in_counts)
+      {
+        p->SetVal(p->GetVal() + q->GetVal());
+      }
+      else if (name == "MinT" && p->GetVal() != q->GetVal())
+      {
+        fprintf(stderr, "AnalMerger::AddDirExtending MinT differs from previous run, %lld vs. %lld. Dying ...\n",
+                p->GetVal(), q->GetVal());
+        exit(1);
+      }
+    }
+    else if (cname == "TParameter<Double_t>" &&
+             ((TParameter<Double_t>*) d)->GetVal() != ((TParameter<Double_t>*) so)->GetVal())
+    {
+      fprintf(stderr, "AnalMerger::AddDirExtending '%s' differs from previous run, %g vs. %g. Dying ...\n",
+              name.Data(), ((TParameter<Double_t>*) d)->GetVal(), ((TParameter<Double_t>*) so)->GetVal());
+      exit(1);
+    }
+    else if (cname == "TNamed" && TString(d->GetTitle()) != so->GetTitle())
+    {
+      fprintf(stderr, "AnalMerger::AddDirExtending '%s' differs from previous run, '%s' vs. '%s'. Dying ...\n",
+              name.Data(), d->GetTitle(), so->GetTitle());
+      exit(1);
+    }
+
+    dst->WriteTObject(d, name, "WriteDelete");
+    delete so;
+    delete d;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+void AnalMerger::FinalizeAnExIo(const TString& file)
+{
+  // Rebuild cumulative histos and graphs from summed per-hour _qhist.
+
+  TFile *f = TFile::Open(file, "update");
+  TNamed *tag = f ? (TNamed*) f->Get("AnalExtractorClass") : 0;
+  if ( ! tag || TString(tag->GetTitle()) != "AnExIo")
+  {
+    delete f;
+    return;
+  }
+
+  vTString_t names, titles;
+  {
+    TIter next(f->GetListOfKeys());
+    while (TKey *key = (TKey*) next())
+    {
+      TString name = key->GetName();
+      if (name.EndsWith("_qhist") &&
+          std::find(names.begin(), names.end(), name) == names.end())
+      {
+        names.push_back(name);
+      }
+    }
+  }
+  for (auto &n : names) n.Remove(n.Length() - 6);
+
+  // XHistoCum only keeps pointers to name and title.
+  titles.resize(names.size());
+
+  std::vector<XHistoCum> chs;
+  Int_t   n_hours = 0;
+  TString time_axis_title;
+
+  for (size_t j = 0; j < names.size(); ++j)
+  {
+    TH1 *q = (TH1*) f->Get(names[j] + "_qhist");
+    TH1 *h = (TH1*) f->Get(names[j]);
+    if ( ! q || ! h)
+    {
+      fprintf(stderr, "AnalMerger::FinalizeAnExIo '%s' incomplete in '%s', skipping.\n",
+              names[j].Data(), file.Data());
+      continue;
+    }
+
+    titles[j] = h->GetTitle();
+    chs.push_back(XHistoCum(names[j], titles[j], h->GetNbinsX(), h->GetXaxis()->GetXmin(), 0, 0));
+
+    n_hours         = q->GetNbinsX();
+    time_axis_title = q->GetXaxis()->GetTitle();
+
+    std::vector<double> &v = chs.back().f_cum;
+    v.resize(n_hours);
+    for (Int_t i = 0; i < n_hours; ++i) v[i] = q->GetBinContent(i + 1);
+
+    // Sampled runs, TH1::Merge() added the shard variances.
+    if (q->GetSumw2N() > 0)
+    {
+      std::vector<double> &e = chs.back().f_err;
+      e.resize(n_hours);
+      for (Int_t i = 0; i < n_hours; ++i) e[i] = q->GetBinError(i + 1);
+    }
+
+    delete q;
+    delete h;
+
+    f->Delete(names[j] + ";*");
+    f->Delete(names[j] + "_qhist;*");
+  }
+
+  f->cd();
+  AnExIo::WriteCumHistos(chs, n_hours, time_axis_title);
+
+  f->Write();
+  f->Close();
+  delete f;
+}
+
+void AnalMerger::PrintCounts(const TString& file)
+{
+  TFile *f = TFile::Open(file);
+  if ( ! f)
+  {
+    fprintf(stderr, "AnalMerger::PrintCounts can not open '%s'.\n", file.Data());
+    return;
+  }
+
+  printf("\n");
+  const char *secs[][2] = { { "Manager",    "Manager"   },
+                            { "Extractors", "Extractor" },
+                            { "Filters",    "Filter"    } };
+  for (auto &sec : secs)
+  {
+    TDirectory *d = f->GetDirectory(TString("Counts/") + sec[0]);
+    if ( ! d) continue;
+
+    TIter next(d->GetListOfKeys());
+    while (TKey *key = (TKey*) next())
+    {
+      TString name = key->GetName();
+      if ( ! name.EndsWith("_pass")) continue;
+
+      TParameter<Long64_t> *p = (TParameter<Long64_t>*) key->ReadObj();
+      name.Remove(name.Length() - 5);
+      printf("%-9s %-24s = %'12lld\n", sec[1], name.Data(), p->GetVal());
+      delete p;
+    }
+  }
+
+  delete f;
+}
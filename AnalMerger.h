@@ -0,0 +1,55 @@
+#ifndef AnalMerger_h
+#define AnalMerger_h
+
+#include <TString.h>
+
+#include <vector>
+
+class TDirectory;
+
+//==============================================================================
+// AnalMerger
+//==============================================================================
+
+// Combines outputs of a job split with AnalManager::SetShard(). Shards are
+// in <out_dir>/shard-*/, each file found there is merged into <out_dir>/
+// by a tree reduction, groups of FanIn files are merged in parallel.
+//
+// Histograms and entry lists are added, counts in anal_manager.root are
+// summed, edge times and extractor class tags have to agree. For AnExIo
+// the per-hour _qhist histos are summed and the cumulative histos and
+// graphs are rebuilt from them. Skim trees are not merged, chain them.
+// Also merges previous results into those of an incremental run.
+
+class AnalMerger
+{
+  typedef std::vector<TString> vTString_t;
+
+  TString   mOutDir;
+  Int_t     mNThreads;
+  Int_t     mFanIn;
+
+  bool MergeGroup(const vTString_t& in, const TString& out);
+  void MergeDir(std::vector<TDirectory*>& in, TDirectory* out, bool in_counts);
+
+  void AddDirExtending(TDirectory* src, TDirectory* dst, bool in_counts);
+
+  void FinalizeAnExIo(const TString& file);
+
+public:
+  AnalMerger(const TString& out_dir, Int_t n_threads=0, Int_t fan_in=4);
+
+  void Merge();
+
+  // Merge files in, written to out.
+  bool MergeFiles(const vTString_t& in, const TString& out);
+
+  // Add results of an earlier run into files in out_dir, for incremental
+  // runs of AnalManager. Time axes of out_dir start at the same time and
+  // are longer, histos with different binning are added bin by bin.
+  void MergePrevious(const TString& prev_dir);
+
+  void PrintCounts(const TString& file);
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "AnalPrefetcher.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
+//==============================================================================
+
+AnalPrefetcher::AnalPrefetcher() :
+  mStop(false),
+  mBytesRead(0), mFilesDone(0)
+{}
+
+AnalPrefetcher::~AnalPrefetcher()
+{
+  Stop();
+}
+
+void AnalPrefetcher::Start()
+{
+  mStop   = false;
+  mThread = std::thread(&AnalPrefetcher::Run, this);
+}
+
+void AnalPrefetcher::Stop()
+{
+  if ( ! mThread.joinable()) return;
+  {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mStop = true;
+    mQueue.clear();
+  }
+  mCond.notify_one();
+  mThread.join();
+}
+
+void AnalPrefetcher::Request(const TString& file)
+{
+  if (file.Contains("://") && ! file.BeginsWith("file://")) return;
+
+  {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueue.push_back(file.BeginsWith("file://") ? TString(file(7, file.Length())) : file);
+  }
+  mCond.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void AnalPrefetcher::Run()
+{
+  while (true)
+  {
+    TString file;
+    {
+      std::unique_lock<std::mutex> lk(mMutex);
+      mCond.wait(lk, [this]() { return mStop || ! mQueue.empty(); });
+      if (mStop) return;
+      file = mQueue.front();
+      mQueue.pop_front();
+    }
+
+    WarmFile(file);
+  }
+}
+
+void AnalPrefetcher::WarmFile(const TString& file)
+{
+  // Sequential read in large blocks, the data itself is thrown away.
+
+  static const size_t BlockSize = 4 * 1024 * 1024;
+
+  int fd = open(file.Data(), O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "AnalPrefetcher::WarmFile could not open '%s'.\n", file.Data());
+    return;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::vector<char> buf(BlockSize);
+  ssize_t n;
+  while ((n = read(fd, &buf[0], BlockSize)) > 0)
+  {
+    mBytesRead += n;
+    if (mStop) break;
+  }
+
+  close(fd);
+
+  ++mFilesDone;
+}
@@ -0,0 +1,47 @@
+#ifndef AnalPrefetcher_h
+#define AnalPrefetcher_h
+
+#include <TString.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+//==============================================================================
+// AnalPrefetcher
+//==============================================================================
+
+// Background thread that reads local files ahead of time so that they are in
+// the page cache by the time TChain switches to them. Remote files (with a
+// protocol prefix) are ignored.
+
+class AnalPrefetcher
+{
+  std::thread             mThread;
+  std::mutex              mMutex;
+  std::condition_variable mCond;
+  std::deque<TString>     mQueue;
+  std::atomic<bool>       mStop;
+
+  std::atomic<Long64_t>   mBytesRead;
+  std::atomic<Int_t>      mFilesDone;
+
+  void Run();
+  void WarmFile(const TString& file);
+
+public:
+  AnalPrefetcher();
+  ~AnalPrefetcher();
+
+  void Start();
+  void Stop();
+
+  void Request(const TString& file);
+
+  Long64_t GetBytesRead() const { return mBytesRead; }
+  Int_t    GetFilesDone() const { return mFilesDone; }
+};
+
+#endif
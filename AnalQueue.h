@@ -0,0 +1,83 @@
+#ifndef AnalQueue_h
+#define AnalQueue_h
+
+#include <Rtypes.h>
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+//==============================================================================
+// AnalQueue
+//==============================================================================
+
+// Bounded lock-free ring buffer for one producer and one consumer thread.
+// Capacity is rounded up to a power of two. Blocking Push() / Pop() spin
+// with yield, counting how often they had to wait; the counters are only
+// touched by their own side and can be read after the threads are joined.
+
+template<typename T>
+class AnalQueue
+{
+  std::vector<T>       m_buf;
+  size_t               m_mask;
+
+  alignas(64) std::atomic<size_t> m_head;  // next slot to pop
+  alignas(64) std::atomic<size_t> m_tail;  // next slot to push
+
+  alignas(64) Long64_t m_n_full_waits;     // by producer
+  Long64_t             m_n_empty_waits;    // by consumer
+
+public:
+  AnalQueue(size_t capacity) :
+    m_head(0), m_tail(0),
+    m_n_full_waits(0), m_n_empty_waits(0)
+  {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    m_buf.resize(n);
+    m_mask = n - 1;
+  }
+
+  bool TryPush(const T& v)
+  {
+    const size_t t = m_tail.load(std::memory_order_relaxed);
+    if (t - m_head.load(std::memory_order_acquire) > m_mask) return false;
+
+    m_buf[t & m_mask] = v;
+    m_tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPop(T& v)
+  {
+    const size_t h = m_head.load(std::memory_order_relaxed);
+    if (h == m_tail.load(std::memory_order_acquire)) return false;
+
+    v = m_buf[h & m_mask];
+    m_head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  void Push(const T& v)
+  {
+    if (TryPush(v)) return;
+    ++m_n_full_waits;
+    while ( ! TryPush(v)) std::this_thread::yield();
+  }
+
+  T Pop()
+  {
+    T v;
+    if (TryPop(v)) return v;
+    ++m_n_empty_waits;
+    while ( ! TryPop(v)) std::this_thread::yield();
+    return v;
+  }
+
+  size_t   Capacity()      const { return m_mask + 1; }
+  Long64_t GetFullWaits()  const { return m_n_full_waits;  }
+  Long64_t GetEmptyWaits() const { return m_n_empty_waits; }
+};
+
+#endif
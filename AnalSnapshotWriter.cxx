@@ -0,0 +1,185 @@
+#include "AnalSnapshotWriter.h"
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TClass.h>
+#include <TH1.h>
+#include <TParameter.h>
+#include <TSystem.h>
+
+#include <cstdio>
+
+//==============================================================================
+
+AnalSnapshotWriter::AnalSnapshotWriter() :
+  mStop(false),
+  mNWritten(0)
+{}
+
+AnalSnapshotWriter::~AnalSnapshotWriter()
+{
+  Stop();
+}
+
+void AnalSnapshotWriter::Start()
+{
+  mStop   = false;
+  mThread = std::thread(&AnalSnapshotWriter::Run, this);
+}
+
+void AnalSnapshotWriter::Stop()
+{
+  if ( ! mThread.joinable()) return;
+  {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mStop = true;
+  }
+  mCond.notify_one();
+  mThread.join();
+}
+
+void AnalSnapshotWriter::Request(const TString& name, const TString& prev, Long64_t n_done,
+                                 Double_t fraction, std::vector<char>&& data)
+{
+  {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mQueue.push_back({ name, prev, n_done, fraction, std::move(data) });
+  }
+  mCond.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void AnalSnapshotWriter::Run()
+{
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lk(mMutex);
+      mCond.wait(lk, [this]() { return mStop || ! mQueue.empty(); });
+      if (mQueue.empty()) return;
+      job = std::move(mQueue.front());
+      mQueue.pop_front();
+    }
+
+    WriteOne(job);
+  }
+}
+
+void AnalSnapshotWriter::WriteOne(Job& job)
+{
+  TString tname = job.f_name + ".tmp";
+
+  FILE *fp = fopen(tname, "w");
+  if ( ! fp || fwrite(&job.f_data[0], 1, job.f_data.size(), fp) != job.f_data.size())
+  {
+    fprintf(stderr, "AnalSnapshotWriter::WriteOne can not write '%s'.\n", tname.Data());
+    if (fp) fclose(fp);
+    return;
+  }
+  fclose(fp);
+
+  TString  worst;
+  Double_t max_change = -1;
+
+  if ( ! job.f_prev.IsNull())
+  {
+    TFile *f = TFile::Open(tname, "update");
+    TFile *p = TFile::Open(job.f_prev);
+
+    TDirectory *fx = f ? f->GetDirectory("Extractors") : 0;
+    TDirectory *px = p ? p->GetDirectory("Extractors") : 0;
+    if (fx && px)
+    {
+      TDirectory *conv = f->mkdir("Convergence");
+
+      TIter next(fx->GetListOfKeys());
+      while (TKey *key = (TKey*) next())
+      {
+        TDirectory *ed = fx->GetDirectory(key->GetName());
+        TDirectory *pd = px->GetDirectory(key->GetName());
+        if ( ! ed || ! pd) continue;
+
+        TString  w;
+        Double_t d = MaxShapeChange(ed, pd, w);
+
+        TParameter<Double_t> par(key->GetName(), d);
+        conv->WriteTObject(&par);
+
+        if (d > max_change)
+        {
+          max_change = d;
+          worst      = TString(key->GetName()) + "/" + w;
+        }
+      }
+    }
+
+    if (f) { f->Close(); delete f; }
+    if (p) { p->Close(); delete p; }
+  }
+
+  if (gSystem->Rename(tname, job.f_name) != 0)
+  {
+    fprintf(stderr, "AnalSnapshotWriter::WriteOne can not rename '%s'.\n", tname.Data());
+    return;
+  }
+
+  ++mNWritten;
+
+  if (job.f_fraction > 0)
+    printf("Snapshot %s at %.1f%% of entries", gSystem->BaseName(job.f_name), 100 * job.f_fraction);
+  else
+    printf("Snapshot %s after %lld entries", gSystem->BaseName(job.f_name), job.f_n_done);
+  if (max_change >= 0)
+    printf(", largest shape change %.4f in %s", max_change, worst.Data());
+  printf(".\n");
+}
+
+Double_t AnalSnapshotWriter::MaxShapeChange(TDirectory* cur, TDirectory* prev, TString& worst)
+{
+  // Histograms empty in either snapshot are skipped.
+
+  Double_t max = 0;
+
+  TIter next(cur->GetListOfKeys());
+  while (TKey *key = (TKey*) next())
+  {
+    TClass *cls = TClass::GetClass(key->GetClassName());
+    if ( ! cls) continue;
+
+    if (cls->InheritsFrom(TDirectory::Class()))
+    {
+      TDirectory *pd = prev->GetDirectory(key->GetName());
+      if ( ! pd) continue;
+
+      TString  w;
+      Double_t d = MaxShapeChange(cur->GetDirectory(key->GetName()), pd, w);
+      if (d > max)
+      {
+        max   = d;
+        worst = TString(key->GetName()) + "/" + w;
+      }
+    }
+    else if (cls->InheritsFrom(TH1::Class()))
+    {
+      TH1 *h  = (TH1*) key->ReadObj();
+      TH1 *hp = (TH1*) prev->Get(key->GetName());
+
+      if (h && hp && h->Integral() > 0 && hp->Integral() > 0)
+      {
+        Double_t d = h->KolmogorovTest(hp, "M");
+        if (d > max)
+        {
+          max   = d;
+          worst = key->GetName();
+        }
+      }
+
+      delete h;
+      delete hp;
+    }
+  }
+
+  return max;
+}
@@ -0,0 +1,66 @@
+#ifndef AnalSnapshotWriter_h
+#define AnalSnapshotWriter_h
+
+#include <TString.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+
+class TDirectory;
+
+//==============================================================================
+// AnalSnapshotWriter
+//==============================================================================
+
+// Background thread that writes in-flight snapshots, see
+// AnalManager::SetSnapshots(). The event loop hands over a serialized
+// ROOT file; here it is stored under a temporary name, compared with the
+// previous snapshot of the same manager and renamed into place.
+//
+// Convergence/<extractor> holds the largest Kolmogorov distance (shape
+// change) between any histogram of the extractor in this and in the
+// previous snapshot.
+
+class AnalSnapshotWriter
+{
+  struct Job
+  {
+    TString           f_name;
+    TString           f_prev;     // previous snapshot, empty for the first
+    Long64_t          f_n_done;
+    Double_t          f_fraction; // of entries done, 0 when unknown
+    std::vector<char> f_data;
+  };
+
+  std::thread             mThread;
+  std::mutex              mMutex;
+  std::condition_variable mCond;
+  std::deque<Job>         mQueue;
+  bool                    mStop;
+
+  std::atomic<Int_t>      mNWritten;
+
+  void Run();
+  void WriteOne(Job& job);
+
+  static Double_t MaxShapeChange(TDirectory* cur, TDirectory* prev, TString& worst);
+
+public:
+  AnalSnapshotWriter();
+  ~AnalSnapshotWriter();
+
+  void Start();
+  // Writes all queued snapshots, then returns.
+  void Stop();
+
+  void Request(const TString& name, const TString& prev, Long64_t n_done, Double_t fraction,
+               std::vector<char>&& data);
+
+  Int_t GetNWritten() const { return mNWritten; }
+};
+
+#endif
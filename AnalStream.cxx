@@ -0,0 +1,217 @@
+#include "AnalStream.h"
+
+#include <TBufferFile.h>
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//==============================================================================
+
+AnalStream::AnalStream(const TString& source, Double_t idle_timeout) :
+  mIdleTimeout(idle_timeout),
+  mListenFd(-1), mFd(-1),
+  mBuf(1024 * 1024), mBeg(0), mEnd(0), mRecLen(0),
+  mNRecords(0), mNBytes(0)
+{
+  mIsSocket = source.BeginsWith("unix:");
+  mSource   = mIsSocket ? TString(source(5, source.Length())) : source;
+}
+
+AnalStream::~AnalStream()
+{
+  Close();
+}
+
+bool AnalStream::Open()
+{
+  if ( ! mIsSocket)
+  {
+    mFd = open(mSource.Data(), O_RDONLY);
+    if (mFd < 0)
+    {
+      fprintf(stderr, "AnalStream::Open can not open '%s'.\n", mSource.Data());
+      return false;
+    }
+    return true;
+  }
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (mSource.Length() >= (Ssiz_t) sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "AnalStream::Open socket path '%s' too long.\n", mSource.Data());
+    return false;
+  }
+  strcpy(addr.sun_path, mSource.Data());
+
+  unlink(mSource.Data());
+
+  mListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (mListenFd < 0 ||
+      bind(mListenFd, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+      listen(mListenFd, 1) != 0)
+  {
+    fprintf(stderr, "AnalStream::Open can not listen on '%s': %s.\n", mSource.Data(), strerror(errno));
+    return false;
+  }
+
+  printf("AnalStream::Open listening on '%s'.\n", mSource.Data());
+  return true;
+}
+
+void AnalStream::Close()
+{
+  if (mFd >= 0) { close(mFd); mFd = -1; }
+  if (mListenFd >= 0)
+  {
+    close(mListenFd);
+    mListenFd = -1;
+    unlink(mSource.Data());
+  }
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalStream::Fill()
+{
+  // Move unread bytes to the front, grow for records bigger than mBuf.
+
+  if (mBeg > 0)
+  {
+    memmove(&mBuf[0], &mBuf[mBeg], mEnd - mBeg);
+    mEnd -= mBeg;
+    mBeg  = 0;
+  }
+  if (mEnd == mBuf.size()) mBuf.resize(2 * mBuf.size());
+
+  auto idle_start = std::chrono::steady_clock::now();
+
+  while (true)
+  {
+    // Files are always readable, sockets only read when poll says so, so
+    // a silent producer does not block past the idle timeout.
+    bool readable = ! mIsSocket;
+
+    if (mIsSocket && mFd < 0)
+    {
+      pollfd pfd = { mListenFd, POLLIN, 0 };
+      if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN))
+      {
+        mFd = accept(mListenFd, 0, 0);
+        if (mFd >= 0) printf("AnalStream::Fill producer connected.\n");
+      }
+    }
+    else if (mIsSocket)
+    {
+      pollfd pfd = { mFd, POLLIN, 0 };
+      readable = poll(&pfd, 1, 1000) > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR));
+    }
+
+    if (mFd >= 0 && readable)
+    {
+      ssize_t n = read(mFd, &mBuf[mEnd], mBuf.size() - mEnd);
+      if (n > 0)
+      {
+        mEnd   += n;
+        mNBytes += n;
+        return true;
+      }
+      if (n == 0 && mIsSocket)
+      {
+        // Producer is gone, a partial record can not be completed.
+        printf("AnalStream::Fill producer disconnected.\n");
+        close(mFd);
+        mFd     = -1;
+        mBeg    = mEnd = 0;
+        mRecLen = 0;
+      }
+      else if (n == 0)
+      {
+        // End of a growing file, check again later.
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      }
+      else if (errno != EINTR && errno != EAGAIN)
+      {
+        fprintf(stderr, "AnalStream::Fill read error: %s.\n", strerror(errno));
+        return false;
+      }
+    }
+
+    if (mIdleTimeout > 0 &&
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_start).count() > mIdleTimeout)
+    {
+      printf("AnalStream::Fill no data for %.0f s, ending.\n", mIdleTimeout);
+      return false;
+    }
+  }
+}
+
+bool AnalStream::Next()
+{
+  // Header is parsed again after each Fill(): a producer that disconnects
+  // mid-record leaves an empty buffer and the next one starts afresh.
+
+  const size_t hdr = sizeof(UInt_t);
+
+  while (true)
+  {
+    if (mEnd - mBeg >= hdr)
+    {
+      memcpy(&mRecLen, &mBuf[mBeg], hdr);
+      if (mRecLen == 0)
+      {
+        mBeg += hdr;
+        return false;
+      }
+      if (mEnd - mBeg >= hdr + mRecLen) return true;
+    }
+
+    if ( ! Fill()) return false;
+  }
+}
+
+void AnalStream::Decode(SXrdFileInfo& F, SXrdUserInfo& U, SXrdServerInfo& S, SXrdIoInfo& I)
+{
+  const size_t hdr = sizeof(UInt_t);
+
+  TBufferFile buf(TBuffer::kRead, mRecLen, &mBuf[mBeg + hdr], kFALSE);
+  F.Streamer(buf);
+  U.Streamer(buf);
+  S.Streamer(buf);
+  I.Streamer(buf);
+
+  mBeg += hdr + mRecLen;
+  ++mNRecords;
+}
+
+//------------------------------------------------------------------------------
+
+void AnalStream::Encode(SXrdFileInfo& F, SXrdUserInfo& U, SXrdServerInfo& S, SXrdIoInfo& I,
+                        std::vector<char>& out)
+{
+  TBufferFile buf(TBuffer::kWrite, 16 * 1024);
+  F.Streamer(buf);
+  U.Streamer(buf);
+  S.Streamer(buf);
+  I.Streamer(buf);
+
+  UInt_t len = buf.Length();
+  out.resize(sizeof(len) + len);
+  memcpy(&out[0], &len, sizeof(len));
+  memcpy(&out[sizeof(len)], buf.Buffer(), len);
+}
+
+void AnalStream::EncodeEnd(std::vector<char>& out)
+{
+  UInt_t len = 0;
+  out.resize(sizeof(len));
+  memcpy(&out[0], &len, sizeof(len));
+}
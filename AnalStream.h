@@ -0,0 +1,63 @@
+#ifndef AnalStream_h
+#define AnalStream_h
+
+#include "SXrdClasses.h"
+
+#include <TString.h>
+
+#include <vector>
+
+//==============================================================================
+// AnalStream
+//==============================================================================
+
+// Live source of XrdFar records, see AnalManager::SetStream(). A record is
+// a native UInt_t length followed by F, U, S and I streamed into a
+// TBufferFile, so class versions travel with the data. A zero length
+// marks the end of the stream.
+//
+// Source "unix:<path>" listens on a local socket and takes one producer
+// at a time; when it disconnects the next one can connect. Anything else
+// is a file that is read as it grows.
+
+class AnalStream
+{
+  TString           mSource;
+  Bool_t            mIsSocket;
+  Double_t          mIdleTimeout;  // seconds, 0 waits forever
+
+  int               mListenFd;
+  int               mFd;
+
+  std::vector<char> mBuf;
+  size_t            mBeg, mEnd;    // unread bytes in mBuf
+  UInt_t            mRecLen;       // payload of current record at mBeg
+
+  Long64_t          mNRecords;
+  Long64_t          mNBytes;
+
+  // Read more bytes, waiting for them. False on idle timeout.
+  bool Fill();
+
+public:
+  AnalStream(const TString& source, Double_t idle_timeout=0);
+  ~AnalStream();
+
+  bool Open();
+  void Close();
+
+  // Wait for the next complete record, false at end of stream.
+  bool Next();
+  // Unpack the record found by Next().
+  void Decode(SXrdFileInfo& F, SXrdUserInfo& U, SXrdServerInfo& S, SXrdIoInfo& I);
+
+  // Record with the framing, for producers.
+  static void Encode(SXrdFileInfo& F, SXrdUserInfo& U, SXrdServerInfo& S, SXrdIoInfo& I,
+                     std::vector<char>& out);
+  static void EncodeEnd(std::vector<char>& out);
+
+  Long64_t GetNRecords() const { return mNRecords; }
+  Long64_t GetNBytes()   const { return mNBytes; }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef AnalTiming_h
+#define AnalTiming_h
+
+#include <Rtypes.h>
+
+#include <chrono>
+#include <time.h>
+
+//==============================================================================
+// AnalStageTime, AnalStageTimer
+//==============================================================================
+
+// Wall and thread CPU time accumulated in one stage of the event loop.
+
+struct AnalStageTime
+{
+  Double_t f_wall = 0;
+  Double_t f_cpu  = 0;
+
+  void Add(const AnalStageTime& t) { f_wall += t.f_wall; f_cpu += t.f_cpu; }
+};
+
+// Adds time between construction and destruction to an AnalStageTime.
+// Costs two clock reads per end, cheap enough to be always on.
+
+class AnalStageTimer
+{
+  typedef std::chrono::steady_clock steady_t;
+
+  AnalStageTime        &m_acc;
+  steady_t::time_point  m_wall0;
+  Double_t              m_cpu0;
+
+  static Double_t thread_cpu()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+  }
+
+public:
+  AnalStageTimer(AnalStageTime& acc) :
+    m_acc(acc), m_wall0(steady_t::now()), m_cpu0(thread_cpu())
+  {}
+
+  ~AnalStageTimer()
+  {
+    m_acc.f_wall += std::chrono::duration<double>(steady_t::now() - m_wall0).count();
+    m_acc.f_cpu  += thread_cpu() - m_cpu0;
+  }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "AnalWorkQueue.h"
+
+//==============================================================================
+
+AnalWorkQueue::AnalWorkQueue(const vRange_t& units, Int_t n_workers) :
+  mNStolen(0)
+{
+  Long64_t n_total = 0;
+  for (auto &u : units) n_total += u.second - u.first;
+
+  for (Int_t i = 0; i < n_workers; ++i) mBlocks.emplace_back(new Block);
+
+  // Consecutive units to the same worker, move on once its share is full.
+  Int_t    w    = 0;
+  Long64_t done = 0;
+  for (auto &u : units)
+  {
+    while (w + 1 < n_workers && done >= (w + 1) * n_total / n_workers) ++w;
+
+    Long64_t n = u.second - u.first;
+    mBlocks[w]->f_units.push_back(u);
+    mBlocks[w]->f_n_left += n;
+    done                 += n;
+  }
+}
+
+vRange_t AnalWorkQueue::GetBlock(Int_t worker) const
+{
+  const auto &u = mBlocks[worker]->f_units;
+  return vRange_t(u.begin(), u.end());
+}
+
+//------------------------------------------------------------------------------
+
+bool AnalWorkQueue::Next(Int_t worker, Range_t& unit)
+{
+  {
+    Block &b = *mBlocks[worker];
+    std::lock_guard<std::mutex> lock(b.f_mutex);
+    if ( ! b.f_units.empty())
+    {
+      unit = b.f_units.front();
+      b.f_units.pop_front();
+      b.f_n_left -= unit.second - unit.first;
+      return true;
+    }
+  }
+
+  for (;;)
+  {
+    Int_t    victim = -1;
+    Long64_t most   = 0;
+    for (Int_t i = 0; i < (Int_t) mBlocks.size(); ++i)
+    {
+      if (mBlocks[i]->f_n_left > most) { most = mBlocks[i]->f_n_left; victim = i; }
+    }
+    if (victim < 0) return false;
+
+    Block &b = *mBlocks[victim];
+    std::lock_guard<std::mutex> lock(b.f_mutex);
+    // Might have been emptied since, then look again.
+    if ( ! b.f_units.empty())
+    {
+      unit = b.f_units.back();
+      b.f_units.pop_back();
+      b.f_n_left -= unit.second - unit.first;
+      ++mNStolen;
+      return true;
+    }
+  }
+}
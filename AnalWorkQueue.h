@@ -0,0 +1,56 @@
+#ifndef AnalWorkQueue_h
+#define AnalWorkQueue_h
+
+#include <Rtypes.h>
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <atomic>
+
+// Ranges of chain entries, [first, second).
+typedef std::vector<std::pair<Long64_t, Long64_t>> vRange_t;
+
+//==============================================================================
+// AnalWorkQueue
+//==============================================================================
+
+// Work units (entry ranges) for parallel workers. Each worker starts with a
+// consecutive block of units of about equal entry count and takes them from
+// the front; when its own block is exhausted it steals a unit from the back
+// of the block with the most entries left. Units are coarse, a mutex per
+// block is enough.
+
+class AnalWorkQueue
+{
+public:
+  typedef std::pair<Long64_t, Long64_t> Range_t;
+
+private:
+  struct Block
+  {
+    std::mutex            f_mutex;
+    std::deque<Range_t>   f_units;
+    std::atomic<Long64_t> f_n_left;   // entries in f_units
+
+    Block() : f_n_left(0) {}
+  };
+
+  std::vector<std::unique_ptr<Block>> mBlocks;
+  std::atomic<Int_t>    mNStolen;
+
+public:
+  AnalWorkQueue(const vRange_t& units, Int_t n_workers);
+
+  // Next unit for the worker, false when there is no work left.
+  bool Next(Int_t worker, Range_t& unit);
+
+  // Initial block of a worker, for a fixed assignment that is the same in
+  // every run with the same input. Call before any Next().
+  vRange_t GetBlock(Int_t worker) const;
+
+  Int_t GetNStolen() const { return mNStolen; }
+};
+
+#endif
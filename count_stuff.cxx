@@ -36,6 +36,11 @@ const int  N_DUMP_FILES = 50;
 
 const bool DO_FILES = true; // false;
 
+// deep_dump() is the only user of I., by far the biggest branch. Without
+// it the scan reads a fraction of the bytes. Off anyway when the input
+// has no I., as files split with repack_xrdfar -s.
+const bool DO_DEEP_DUMP = true; // false;
+
 
 //==============================================================================
 // Countor
@@ -222,7 +227,23 @@ int main(int argc, char *argv[])
   mychain.SetBranchAddress("F.", &fp);
   mychain.SetBranchAddress("U.", &up);
   mychain.SetBranchAddress("S.", &sp);
-  mychain.SetBranchAddress("I.", &ip);
+
+  const bool do_deep_dump = DO_DEEP_DUMP && mychain.GetBranch("I.");
+  if (DO_DEEP_DUMP && ! do_deep_dump)
+  {
+    printf("No I. branch in input, deep dump is off.\n");
+  }
+
+  if (do_deep_dump)
+  {
+    mychain.SetBranchAddress("I.", &ip);
+  }
+  else
+  {
+    // Files split with repack_xrdfar -s do not have it at all.
+    UInt_t found;
+    mychain.SetBranchStatus("I.*", 0, &found);
+  }
 
 
   Countor C;
@@ -399,7 +420,7 @@ int main(int argc, char *argv[])
 
     // ----------------------------------------------------------------
 
-    deep_dump(false);
+    if (do_deep_dump) deep_dump(false);
   }
 
   // ------------------------------------------------------------------------
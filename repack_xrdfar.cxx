@@ -0,0 +1,338 @@
+// Rewrite XrdFar files for repeated analysis scans: chosen compression,
+// baskets sized by ROOT at the first cluster, clusters of a fixed number of
+// entries. Optionally move the I. branch into friend files, tree XrdFarIo
+// with the same entries in io/ under the output directory, see
+// AnalManager::SetIoFriend(). Then compare read throughput of original and
+// repacked files.
+
+/*
+  make repack_xrdfar
+  ./repack_xrdfar -a zstd -l 5 -o /bar/xrdmon-far-repacked /bar/xrdmon-far-merged/xmfar-2017-*.root
+  ./repack_xrdfar -s -o /bar/xrdmon-xxx-repacked /bar/xrdmon-xxx-merged/xmxxx-2017-*.root
+*/
+
+#include "SXrdClasses.h"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TChain.h"
+#include "TSystem.h"
+#include "TStopwatch.h"
+#include "Compression.h"
+
+#include <vector>
+#include <set>
+#include <unistd.h>
+
+//==============================================================================
+// Configuration
+//==============================================================================
+
+// 64k entries per cluster: same as the block size of AnalFileIndex, so a
+// time window drops whole clusters, and fine enough for cluster-aligned
+// work units of AnalManager::ProcessParallel().
+
+struct RepackConfig
+{
+  TString  f_tree_name     = "XrdFar";
+  TString  f_out_dir       = ".";
+  TString  f_io_dir;                 // set when I. is split off
+  Int_t    f_algorithm     = ROOT::RCompressionSetting::EAlgorithm::kZSTD;
+  Int_t    f_level         = 5;
+  Long64_t f_cluster       = 65536;
+  Long64_t f_bench_entries = 1000000;
+  bool     f_bench         = true;
+};
+
+void usage()
+{
+  printf("Usage: repack_xrdfar [options] file1.root ...\n"
+         "  -a alg     compression algorithm: zlib, lzma, lz4, zstd (default zstd)\n"
+         "  -l level   compression level (default 5)\n"
+         "  -c n       entries per cluster (default 65536)\n"
+         "  -t name    tree name (default XrdFar)\n"
+         "  -o dir     output directory, must differ from input (default .)\n"
+         "  -s         split I. into friend files in <dir>/io/\n"
+         "  -e n       entries to read in throughput comparison (default 1M, 0 for all)\n"
+         "  -n         no throughput comparison\n");
+}
+
+//==============================================================================
+// Repack
+//==============================================================================
+
+bool repack(const RepackConfig& cfg, const TString& in_name, const TString& out_name)
+{
+  TFile *fin = TFile::Open(in_name);
+  if ( ! fin || fin->IsZombie())
+  {
+    fprintf(stderr, "Can not open '%s'.\n", in_name.Data());
+    return false;
+  }
+  TTree *tin = (TTree*) fin->Get(cfg.f_tree_name);
+  if ( ! tin)
+  {
+    fprintf(stderr, "No tree '%s' in '%s'.\n", cfg.f_tree_name.Data(), in_name.Data());
+    delete fin;
+    return false;
+  }
+
+  TFile *fout = TFile::Open(out_name, "recreate", "",
+                            ROOT::CompressionSettings((ROOT::RCompressionSetting::EAlgorithm::EValues) cfg.f_algorithm,
+                                                      cfg.f_level));
+  if ( ! fout || fout->IsZombie())
+  {
+    fprintf(stderr, "Can not create '%s'.\n", out_name.Data());
+    delete fin;
+    return false;
+  }
+
+  // Structure only, baskets are then recompressed with the file's setting.
+  // Positive auto-flush is in entries; ROOT resizes baskets to the data of
+  // the first cluster. Disabled branches are not cloned.
+  if ( ! cfg.f_io_dir.IsNull()) tin->SetBranchStatus("I.*", 0);
+
+  TTree *tout = tin->CloneTree(0);
+  tout->SetAutoFlush(cfg.f_cluster);
+  tout->CopyEntries(tin, -1, "");
+
+  fout->cd();
+  tout->Write();
+
+  printf("  %s: %lld entries, %.1f -> %.1f MB", gSystem->BaseName(in_name), tin->GetEntries(),
+         fin->GetSize() / 1048576.0, fout->GetSize() / 1048576.0);
+
+  fout->Close();
+  delete fout;
+
+  if ( ! cfg.f_io_dir.IsNull())
+  {
+    // Second pass over the input for I. only, same entries and clusters.
+    TString io_name = cfg.f_io_dir + "/" + gSystem->BaseName(in_name);
+
+    TFile *fio = TFile::Open(io_name, "recreate", "",
+                             ROOT::CompressionSettings((ROOT::RCompressionSetting::EAlgorithm::EValues) cfg.f_algorithm,
+                                                       cfg.f_level));
+    if ( ! fio || fio->IsZombie())
+    {
+      fprintf(stderr, "\nCan not create '%s'.\n", io_name.Data());
+      delete fin;
+      return false;
+    }
+
+    tin->SetBranchStatus("*", 0);
+    tin->SetBranchStatus("I.*", 1);
+
+    TTree *tio = tin->CloneTree(0);
+    tio->SetName(cfg.f_tree_name + "Io");
+    tio->SetAutoFlush(cfg.f_cluster);
+    tio->CopyEntries(tin, -1, "");
+
+    fio->cd();
+    tio->Write();
+
+    printf(" + %.1f MB I.", fio->GetSize() / 1048576.0);
+
+    fio->Close();
+    delete fio;
+  }
+  printf("\n");
+
+  fin->Close();
+  delete fin;
+
+  return true;
+}
+
+//==============================================================================
+// Throughput comparison
+//==============================================================================
+
+struct ScanResult
+{
+  Long64_t f_entries = 0;
+  Long64_t f_bytes   = 0;   // decompressed
+  Double_t f_wall    = 0;
+  Double_t f_cpu     = 0;
+};
+
+ScanResult scan(const RepackConfig& cfg, const std::vector<TString>& files, bool with_io,
+               const TString& io_dir = "")
+{
+  SXrdFileInfo   F, *fp = &F;
+  SXrdUserInfo   U, *up = &U;
+  SXrdServerInfo S, *sp = &S;
+  SXrdIoInfo     I, *ip = &I;
+
+  TChain chain(cfg.f_tree_name);
+  for (auto &f : files) chain.Add(f);
+
+  // Only attached when needed, like AnalManager does.
+  TChain io_chain(cfg.f_tree_name + "Io");
+  if (with_io && ! io_dir.IsNull())
+  {
+    for (auto &f : files) io_chain.Add(io_dir + "/" + gSystem->BaseName(f));
+    chain.AddFriend(&io_chain);
+  }
+
+  ScanResult r;
+
+  // Files without I. would only give ROOT errors.
+  if (with_io && ! chain.GetBranch("I.")) return r;
+
+  chain.SetBranchStatus("*", 0);
+  chain.SetBranchStatus("F.*", 1);
+  chain.SetBranchStatus("U.*", 1);
+  chain.SetBranchStatus("S.*", 1);
+  chain.SetBranchAddress("F.", &fp);
+  chain.SetBranchAddress("U.", &up);
+  chain.SetBranchAddress("S.", &sp);
+  if (with_io)
+  {
+    chain.SetBranchStatus("I.*", 1);
+    chain.SetBranchAddress("I.", &ip);
+  }
+  chain.SetCacheSize(100 * 1024 * 1024);
+
+  Long64_t n = chain.GetEntries();
+  if (cfg.f_bench_entries > 0 && cfg.f_bench_entries < n) n = cfg.f_bench_entries;
+
+  TStopwatch sw;
+  sw.Start();
+  for (Long64_t i = 0; i < n; ++i)
+  {
+    r.f_bytes += chain.GetEntry(i);
+  }
+  sw.Stop();
+
+  r.f_entries = n;
+  r.f_wall    = sw.RealTime();
+  r.f_cpu     = sw.CpuTime();
+  return r;
+}
+
+void compare(const RepackConfig& cfg, const std::vector<TString>& orig, const std::vector<TString>& repacked)
+{
+  printf("\nRead throughput, each scan is done twice and the second one is shown, so\n"
+         "both sets are in the page cache and decompression cost dominates.\n\n");
+  printf("%-22s %12s %10s %10s %12s %12s\n", "", "entries", "wall [s]", "cpu [s]", "events / s", "MB / s");
+
+  for (int with_io = 0; with_io < 2; ++with_io)
+  {
+    for (int set = 0; set < 2; ++set)
+    {
+      const std::vector<TString> &files = set == 0 ? orig : repacked;
+
+      const TString io_dir = set == 0 ? "" : cfg.f_io_dir;
+
+      scan(cfg, files, with_io, io_dir);
+      ScanResult r = scan(cfg, files, with_io, io_dir);
+
+      TString label = TString(with_io ? "F/U/S/I" : "F/U/S") + (set == 0 ? " original" : " repacked");
+      if (r.f_entries == 0)
+      {
+        printf("%-22s no I. branch\n", label.Data());
+        continue;
+      }
+      printf("%-22s %'12lld %10.2f %10.2f %12.0f %12.2f\n", label.Data(), r.f_entries, r.f_wall, r.f_cpu,
+             r.f_entries / r.f_wall, r.f_bytes / r.f_wall / 1048576);
+    }
+  }
+}
+
+//==============================================================================
+// main
+//==============================================================================
+
+int main(int argc, char *argv[])
+{
+  RepackConfig cfg;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:l:c:t:o:se:nh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a':
+      {
+        TString a(optarg);
+        a.ToLower();
+        if      (a == "zlib") cfg.f_algorithm = ROOT::RCompressionSetting::EAlgorithm::kZLIB;
+        else if (a == "lzma") cfg.f_algorithm = ROOT::RCompressionSetting::EAlgorithm::kLZMA;
+        else if (a == "lz4")  cfg.f_algorithm = ROOT::RCompressionSetting::EAlgorithm::kLZ4;
+        else if (a == "zstd") cfg.f_algorithm = ROOT::RCompressionSetting::EAlgorithm::kZSTD;
+        else
+        {
+          fprintf(stderr, "Unknown compression algorithm '%s'. Dying ...\n", optarg);
+          exit(1);
+        }
+        break;
+      }
+      case 'l': cfg.f_level         = atoi(optarg);  break;
+      case 'c': cfg.f_cluster       = atoll(optarg); break;
+      case 't': cfg.f_tree_name     = optarg;        break;
+      case 'o': cfg.f_out_dir       = optarg;        break;
+      case 's': cfg.f_io_dir        = "io";          break;
+      case 'e': cfg.f_bench_entries = atoll(optarg); break;
+      case 'n': cfg.f_bench         = false;         break;
+      default:  usage(); exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    usage();
+    exit(1);
+  }
+
+  gSystem->mkdir(cfg.f_out_dir, true);
+  if ( ! cfg.f_io_dir.IsNull())
+  {
+    cfg.f_io_dir = cfg.f_out_dir + "/io";
+    gSystem->mkdir(cfg.f_io_dir, true);
+  }
+
+  // Outputs are named by input basename, same names from different
+  // directories would overwrite each other.
+  std::set<TString> base_names;
+  for (int i = optind; i < argc; ++i)
+  {
+    if ( ! base_names.insert(gSystem->BaseName(argv[i])).second)
+    {
+      fprintf(stderr, "Input '%s' has the same file name as an earlier one. Dying ...\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  std::vector<TString> orig, repacked;
+  for (int i = optind; i < argc; ++i)
+  {
+    TString in_name  = argv[i];
+    TString out_name = cfg.f_out_dir + "/" + gSystem->BaseName(in_name);
+
+    FileStat_t st_in, st_out;
+    if (gSystem->GetPathInfo(in_name,  st_in)  == 0 &&
+        gSystem->GetPathInfo(out_name, st_out) == 0 &&
+        st_in.fDev == st_out.fDev && st_in.fIno == st_out.fIno)
+    {
+      fprintf(stderr, "Output '%s' would overwrite input. Dying ...\n", out_name.Data());
+      exit(1);
+    }
+
+    if ( ! repack(cfg, in_name, out_name))
+    {
+      fprintf(stderr, "Repacking of '%s' failed. Dying ...\n", in_name.Data());
+      exit(1);
+    }
+
+    orig.push_back(in_name);
+    repacked.push_back(out_name);
+  }
+
+  if (cfg.f_bench)
+  {
+    compare(cfg, orig, repacked);
+  }
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+// Stream entries of XrdFar files as AnalStream records at a given rate,
+// to a local socket that an AnalManager with SetStream("unix:<path>")
+// listens on, or appended to a file it follows. For testing of streamed
+// analysis without a live collector.
+
+/*
+  make replay_xrdfar
+  ./replay_xrdfar -r 2000 -e unix:/tmp/xrdfar.sock /bar/xrdmon-far-merged/xmfar-2017-01.root
+  ./replay_xrdfar -r 0 -n 100000 /tmp/xrdfar.stream /bar/xrdmon-far-merged/xmfar-2017-*.root
+*/
+
+#include "AnalStream.h"
+
+#include "TChain.h"
+#include "TSystem.h"
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//==============================================================================
+// Configuration
+//==============================================================================
+
+struct ReplayConfig
+{
+  TString  f_tree_name = "XrdFar";
+  Double_t f_rate      = 1000;   // records / s, 0 for as fast as possible
+  Long64_t f_max       = 0;      // 0 for all
+  bool     f_send_end  = false;
+};
+
+void usage()
+{
+  printf("Usage: replay_xrdfar [options] target file1.root ...\n"
+         "  target     unix:<path> to connect to a socket, else a file to append to\n"
+         "  -r rate    records per second, 0 for no limit (default 1000)\n"
+         "  -n n       number of entries to send (default all)\n"
+         "  -t name    tree name (default XrdFar)\n"
+         "  -e         send end-of-stream record at the end\n");
+}
+
+//==============================================================================
+// Output
+//==============================================================================
+
+int open_target(const TString& target)
+{
+  if ( ! target.BeginsWith("unix:"))
+  {
+    return open(target.Data(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  }
+
+  TString path = target(5, target.Length());
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.Length() >= (Ssiz_t) sizeof(addr.sun_path)) return -1;
+  strcpy(addr.sun_path, path.Data());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+bool write_all(int fd, const std::vector<char>& buf)
+{
+  size_t done = 0;
+  while (done < buf.size())
+  {
+    ssize_t n = write(fd, &buf[done], buf.size() - done);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+//==============================================================================
+// main
+//==============================================================================
+
+int main(int argc, char *argv[])
+{
+  ReplayConfig cfg;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:t:eh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'r': cfg.f_rate      = atof(optarg);  break;
+      case 'n': cfg.f_max       = atoll(optarg); break;
+      case 't': cfg.f_tree_name = optarg;        break;
+      case 'e': cfg.f_send_end  = true;          break;
+      default:  usage(); exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  if (optind + 1 >= argc)
+  {
+    usage();
+    exit(1);
+  }
+
+  TString target = argv[optind];
+
+  SXrdFileInfo   F, *fp = &F;
+  SXrdUserInfo   U, *up = &U;
+  SXrdServerInfo S, *sp = &S;
+  SXrdIoInfo     I, *ip = &I;
+
+  TChain chain(cfg.f_tree_name);
+  for (int i = optind + 1; i < argc; ++i) chain.Add(argv[i]);
+
+  chain.SetBranchAddress("F.", &fp);
+  chain.SetBranchAddress("U.", &up);
+  chain.SetBranchAddress("S.", &sp);
+  // Files without I. send it empty.
+  if (chain.GetBranch("I.")) chain.SetBranchAddress("I.", &ip);
+  chain.SetCacheSize(100 * 1024 * 1024);
+
+  Long64_t n = chain.GetEntries();
+  if (cfg.f_max > 0 && cfg.f_max < n) n = cfg.f_max;
+
+  // Write errors instead of being killed when the reader goes away.
+  signal(SIGPIPE, SIG_IGN);
+
+  int fd = open_target(target);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Can not open target '%s': %s. Dying ...\n", target.Data(), strerror(errno));
+    exit(1);
+  }
+
+  printf("Replaying %lld entries to '%s'", n, target.Data());
+  if (cfg.f_rate > 0) printf(" at %.0f records / s", cfg.f_rate);
+  printf(" ...\n");
+
+  std::vector<char> buf;
+  Long64_t          n_bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (Long64_t i = 0; i < n; ++i)
+  {
+    if (cfg.f_rate > 0)
+    {
+      std::this_thread::sleep_until(start + std::chrono::duration<double>(i / cfg.f_rate));
+    }
+
+    chain.GetEntry(i);
+
+    AnalStream::Encode(F, U, S, I, buf);
+    if ( ! write_all(fd, buf))
+    {
+      fprintf(stderr, "Write to '%s' failed at entry %lld: %s. Dying ...\n", target.Data(), i, strerror(errno));
+      exit(1);
+    }
+    n_bytes += buf.size();
+  }
+
+  if (cfg.f_send_end)
+  {
+    AnalStream::EncodeEnd(buf);
+    write_all(fd, buf);
+  }
+
+  close(fd);
+
+  Double_t wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("Sent %lld records, %.1f MB in %.1f s, %.0f records / s.\n", n, n_bytes / 1048576.0, wall,
+         wall > 0 ? n / wall : 0);
+
+  return 0;
+}